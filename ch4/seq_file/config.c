@@ -0,0 +1,283 @@
+#include <linux/configfs.h>
+#include <linux/err.h>
+#include <linux/kdev_t.h> // MAJOR, MINOR
+#include <linux/kernel.h> // kstrtoint, kstrtou64, sprintf
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/slab.h>
+
+#include "scull.h"
+
+/*
+ * Devices made and removed at run time, without reloading the module:
+ *
+ *   mkdir /sys/kernel/config/scull/cache
+ *   echo 4096 > /sys/kernel/config/scull/cache/quantum
+ *   echo $((64 << 20)) > /sys/kernel/config/scull/cache/limit
+ *   mknod /dev/scull_cache c $(tr : ' ' < /sys/kernel/config/scull/cache/dev)
+ *   ...
+ *   rmdir /sys/kernel/config/scull/cache
+ *
+ * Each directory is one device with its own geometry (picked up on the
+ * next trim, or at once while the device is empty), memory limit, NUMA
+ * node and throttling rates. Removing the directory takes the device
+ * away from new opens only; the files still open on it keep working
+ * until closed. No other device notices any of this.
+ */
+
+struct scull_item {
+    struct config_item item;
+    struct scull_dev *dev;
+};
+
+static struct scull_dev *to_scull_dev(struct config_item *item) {
+    return container_of(item, struct scull_item, item)->dev;
+}
+
+/*
+ * A device holding nothing can take its new geometry right away
+ */
+
+static int scull_item_set_geometry(struct scull_dev *dev, int quantum, int qset) {
+    if (scull_check_geometry(quantum, qset))
+        return -EINVAL;
+    if (down_write_killable(&dev->sem))
+        return -ERESTARTSYS;
+    dev->cfg_quantum = quantum;
+    dev->cfg_qset = qset;
+    if (list_empty(&dev->qsets) && !atomic_long_read(&dev->size))
+        scull_trim(dev);
+    up_write(&dev->sem);
+    return 0;
+}
+
+static ssize_t scull_item_quantum_show(struct config_item *item, char *page) {
+    struct scull_dev *dev = to_scull_dev(item);
+
+    return sprintf(page, "%d\n", dev->cfg_quantum ? dev->cfg_quantum : scull_quantum);
+}
+
+static ssize_t scull_item_quantum_store(struct config_item *item, const char *page, size_t count) {
+    struct scull_dev *dev = to_scull_dev(item);
+    int quantum, err;
+
+    err = kstrtoint(page, 0, &quantum);
+    if (!err)
+        err = scull_item_set_geometry(dev, quantum, dev->cfg_qset ? dev->cfg_qset : scull_qset);
+    return err ? err : count;
+}
+
+static ssize_t scull_item_qset_show(struct config_item *item, char *page) {
+    struct scull_dev *dev = to_scull_dev(item);
+
+    return sprintf(page, "%d\n", dev->cfg_qset ? dev->cfg_qset : scull_qset);
+}
+
+static ssize_t scull_item_qset_store(struct config_item *item, const char *page, size_t count) {
+    struct scull_dev *dev = to_scull_dev(item);
+    int qset, err;
+
+    err = kstrtoint(page, 0, &qset);
+    if (!err)
+        err = scull_item_set_geometry(dev, dev->cfg_quantum ? dev->cfg_quantum : scull_quantum, qset);
+    return err ? err : count;
+}
+
+/*
+ * Lowering the limit below what the device holds frees nothing: it only
+ * stops the device from growing.
+ */
+
+static ssize_t scull_item_limit_show(struct config_item *item, char *page) {
+    return sprintf(page, "%ld\n", to_scull_dev(item)->limit);
+}
+
+static ssize_t scull_item_limit_store(struct config_item *item, const char *page, size_t count) {
+    struct scull_dev *dev = to_scull_dev(item);
+    long limit;
+    int err;
+
+    err = kstrtol(page, 0, &limit);
+    if (err)
+        return err;
+    if (limit < 0)
+        return -EINVAL;
+    if (down_write_killable(&dev->sem))
+        return -ERESTARTSYS;
+    dev->limit = limit;
+    up_write(&dev->sem);
+    return count;
+}
+
+static ssize_t scull_item_node_show(struct config_item *item, char *page) {
+    return sprintf(page, "%d\n", to_scull_dev(item)->node);
+}
+
+static ssize_t scull_item_node_store(struct config_item *item, const char *page, size_t count) {
+    int node, err;
+
+    err = kstrtoint(page, 0, &node);
+    if (!err)
+        err = scull_set_node(to_scull_dev(item), node);
+    return err ? err : count;
+}
+
+/*
+ * Throttling rates, as with SCULL_IOCSQOS; the other settings are kept
+ */
+
+static ssize_t scull_item_rate_store(struct scull_dev *dev, const char *page, size_t count, int iops) {
+    struct scull_qos qos;
+    u64 rate;
+    int err;
+
+    err = kstrtou64(page, 0, &rate);
+    if (err)
+        return err;
+    scull_qos_get(dev, &qos);
+    if (iops)
+        qos.iops = rate;
+    else
+        qos.bps = rate;
+    err = scull_qos_set(dev, &qos);
+    return err ? err : count;
+}
+
+static ssize_t scull_item_bps_show(struct config_item *item, char *page) {
+    struct scull_qos qos;
+
+    scull_qos_get(to_scull_dev(item), &qos);
+    return sprintf(page, "%llu\n", qos.bps);
+}
+
+static ssize_t scull_item_bps_store(struct config_item *item, const char *page, size_t count) {
+    return scull_item_rate_store(to_scull_dev(item), page, count, 0);
+}
+
+static ssize_t scull_item_iops_show(struct config_item *item, char *page) {
+    struct scull_qos qos;
+
+    scull_qos_get(to_scull_dev(item), &qos);
+    return sprintf(page, "%llu\n", qos.iops);
+}
+
+static ssize_t scull_item_iops_store(struct config_item *item, const char *page, size_t count) {
+    return scull_item_rate_store(to_scull_dev(item), page, count, 1);
+}
+
+static ssize_t scull_item_throttled_show(struct config_item *item, char *page) {
+    struct scull_qos qos;
+
+    scull_qos_get(to_scull_dev(item), &qos);
+    return sprintf(page, "%llu %llu\n", qos.throttled, qos.wait_ns);
+}
+
+static ssize_t scull_item_used_show(struct config_item *item, char *page) {
+    return sprintf(page, "%ld\n", atomic_long_read(&to_scull_dev(item)->mem));
+}
+
+static ssize_t scull_item_dev_show(struct config_item *item, char *page) {
+    struct scull_dev *dev = to_scull_dev(item);
+
+    return sprintf(page, "%d:%d\n", MAJOR(dev->cdev->dev), MINOR(dev->cdev->dev));
+}
+
+CONFIGFS_ATTR(scull_item_, quantum);
+CONFIGFS_ATTR(scull_item_, qset);
+CONFIGFS_ATTR(scull_item_, limit);
+CONFIGFS_ATTR(scull_item_, node);
+CONFIGFS_ATTR(scull_item_, bps);
+CONFIGFS_ATTR(scull_item_, iops);
+CONFIGFS_ATTR_RO(scull_item_, throttled);
+CONFIGFS_ATTR_RO(scull_item_, used);
+CONFIGFS_ATTR_RO(scull_item_, dev);
+
+static struct configfs_attribute *scull_item_attrs[] = {
+        &scull_item_attr_quantum,
+        &scull_item_attr_qset,
+        &scull_item_attr_limit,
+        &scull_item_attr_node,
+        &scull_item_attr_bps,
+        &scull_item_attr_iops,
+        &scull_item_attr_throttled,
+        &scull_item_attr_used,
+        &scull_item_attr_dev,
+        NULL,
+};
+
+/*
+ * rmdir drops the last reference on the item
+ */
+
+static void scull_item_release(struct config_item *item) {
+    struct scull_item *si = container_of(item, struct scull_item, item);
+
+    scull_dev_remove(si->dev);
+    kfree(si);
+}
+
+static struct configfs_item_operations scull_item_ops = {
+        .release = scull_item_release,
+};
+
+static struct config_item_type scull_item_type = {
+        .ct_item_ops = &scull_item_ops,
+        .ct_attrs = scull_item_attrs,
+        .ct_owner = THIS_MODULE,
+};
+
+static struct config_item *scull_make_item(struct config_group *group, const char *name) {
+    struct scull_item *si;
+    struct scull_dev *dev;
+
+    si = kmalloc(sizeof(struct scull_item), GFP_KERNEL);
+    if (!si)
+        return ERR_PTR(-ENOMEM);
+    memset(si, 0, sizeof(struct scull_item));
+    dev = scull_dev_create();
+    if (IS_ERR(dev)) {
+        kfree(si);
+        return ERR_CAST(dev);
+    }
+    si->dev = dev;
+    config_item_init_type_name(&si->item, name, &scull_item_type);
+    printk(KERN_INFO "scull%d: made as %s\n", dev->index, name);
+    return &si->item;
+}
+
+static struct configfs_group_operations scull_group_ops = {
+        .make_item = scull_make_item,
+};
+
+static struct config_item_type scull_subsys_type = {
+        .ct_group_ops = &scull_group_ops,
+        .ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem scull_subsys = {
+        .su_group = {
+                .cg_item = {
+                        .ci_namebuf = "scull",
+                        .ci_type = &scull_subsys_type,
+                },
+        },
+};
+
+static bool scull_subsys_registered;
+
+int scull_config_init(void) {
+    int err;
+
+    config_group_init(&scull_subsys.su_group);
+    mutex_init(&scull_subsys.su_mutex);
+    err = configfs_register_subsystem(&scull_subsys);
+    scull_subsys_registered = !err;
+    return err;
+}
+
+void scull_config_exit(void) {
+    if (scull_subsys_registered)
+        configfs_unregister_subsystem(&scull_subsys);
+    scull_subsys_registered = false;
+}
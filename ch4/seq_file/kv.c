@@ -0,0 +1,457 @@
+#include <linux/kernel.h> // min, u64_to_user_ptr
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
+#include <linux/rwsem.h>
+#include <linux/sched.h> // cond_resched
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/uaccess.h> // copy_from_user
+#include <linux/xarray.h>
+
+#include "scull.h"
+
+/*
+ * Key-value access to a scull device.
+ *
+ * Values are written into the device like any other data, one after
+ * the other, starting past whatever the device held when the first key
+ * went in; an rhashtable maps each key to the offset and length of its
+ * value. A put appends the new value and only then points the key at
+ * it, so a get never sees half a value. The space a value leaves behind
+ * on replace or delete is never reused: instead each quantum holding
+ * values counts their live bytes, and a quantum whose count drops to
+ * zero is punched out of the device. The quantum the last value ends
+ * in is shared once file data is appended behind it, and is never
+ * punched from then on.
+ *
+ * Gets and puts are throttled like reads and writes, one operation
+ * each, charged for the value buffer.
+ *
+ * Gets run in parallel under the read side of the device semaphore;
+ * puts and deletes are serialised by kv->lock, and take the write side
+ * only to punch. The device is still readable and writable as a file,
+ * and writes over a value change it. A trim, truncate or hole punch
+ * empties the index: the values may be gone, and file data may sit
+ * where they were.
+ */
+
+struct scull_kv_key {
+    u32 len;
+    u8 data[SCULL_KV_KEY_MAX]; // zero past len, the whole struct is hashed
+};
+
+struct scull_kv_entry {
+    struct rhash_head node;  // in kv->ht
+    struct scull_kv_key key;
+    loff_t offset;           // of the value in the device
+    u32 len;
+    struct list_head list;   // in kv->entries
+    struct rcu_head rcu;
+};
+
+struct scull_kv {
+    struct rhashtable ht;     // entries by key
+    struct list_head entries; // all of them, for emptying the table
+    struct xarray live;       // live value bytes, by quantum index
+    struct mutex lock;        // serialises puts and deletes
+    loff_t tail;              // the next value goes here
+    unsigned long epoch;      // dev->epoch the entries belong to
+};
+
+static const struct rhashtable_params scull_kv_params = {
+        .key_len = sizeof(struct scull_kv_key),
+        .key_offset = offsetof(struct scull_kv_entry, key),
+        .head_offset = offsetof(struct scull_kv_entry, node),
+        .automatic_shrinking = true,
+};
+
+#define SCULL_KV_SHARED XA_MARK_0 // the quantum holds file data too
+
+int scull_kv_init(struct scull_dev *dev) {
+    struct scull_kv *kv = kmalloc(sizeof(struct scull_kv), GFP_KERNEL);
+    int err;
+
+    if (!kv)
+        return -ENOMEM;
+    memset(kv, 0, sizeof(struct scull_kv));
+    err = rhashtable_init(&kv->ht, &scull_kv_params);
+    if (err) {
+        kfree(kv);
+        return err;
+    }
+    INIT_LIST_HEAD(&kv->entries);
+    xa_init(&kv->live);
+    mutex_init(&kv->lock);
+    kv->epoch = dev->epoch;
+    dev->kv = kv;
+    return 0;
+}
+
+/*
+ * Nobody can look anything up any more: the device is going away
+ */
+
+void scull_kv_free(struct scull_dev *dev) {
+    struct scull_kv *kv = dev->kv;
+    struct scull_kv_entry *e, *next;
+
+    if (!kv)
+        return;
+    list_for_each_entry_safe(e, next, &kv->entries, list)
+        kfree(e);
+    rhashtable_destroy(&kv->ht);
+    xa_destroy(&kv->live);
+    kfree(kv);
+    dev->kv = NULL;
+}
+
+unsigned int scull_kv_count(struct scull_dev *dev) {
+    return dev->kv ? atomic_read(&dev->kv->ht.nelems) : 0;
+}
+
+/*
+ * Drop the entries of a device that lost data. Called with kv->lock
+ * and the read side of the semaphore held; concurrent gets see the old
+ * epoch until the table is empty, and do not look at it.
+ */
+
+static void scull_kv_sync(struct scull_dev *dev, struct scull_kv *kv) {
+    struct scull_kv_entry *e, *next;
+
+    if (kv->epoch == dev->epoch)
+        return;
+    list_for_each_entry_safe(e, next, &kv->entries, list) {
+        rhashtable_remove_fast(&kv->ht, &e->node, scull_kv_params);
+        list_del(&e->list);
+        kfree_rcu(e, rcu);
+    }
+    xa_destroy(&kv->live);
+    kv->tail = 0;
+    smp_store_release(&kv->epoch, dev->epoch);
+}
+
+/*
+ * Read in an op and its key
+ */
+
+static int scull_kv_op(struct scull_kv_op __user *uop, struct scull_kv_op *op,
+                       struct scull_kv_key *key) {
+    if (copy_from_user(op, uop, sizeof(*op)))
+        return -EFAULT;
+    if (op->klen > SCULL_KV_KEY_MAX || op->len > INT_MAX)
+        return -EINVAL;
+    memset(key, 0, sizeof(*key));
+    key->len = op->klen;
+    if (copy_from_user(key->data, u64_to_user_ptr(op->key), op->klen))
+        return -EFAULT;
+    return 0;
+}
+
+/*
+ * Move a whole value between the device and user space
+ */
+
+static int scull_kv_xfer(struct scull_file *sf, char __user *buf, loff_t pos, size_t len, int write) {
+    ssize_t ret;
+
+    while (len) {
+        if (write)
+            ret = scull_do_write(sf, buf, len, &pos);
+        else
+            ret = scull_do_read(sf, buf, len, &pos);
+        if (ret <= 0)
+            return ret ? ret : -ENODATA; // punched or truncated behind our back
+        buf += ret;
+        len -= ret;
+        cond_resched();
+    }
+    return 0;
+}
+
+/*
+ * Count the bytes of [off, off + len) as live in the quanta they fall
+ * in. An xarray slot may need allocating, so every quantum gets one
+ * first; those left at zero on failure are reused by the next put.
+ */
+
+static int scull_kv_charge(struct scull_kv *kv, int quantum, long off, u32 len) {
+    long end = off + len;
+    unsigned long q, last;
+    void *old;
+
+    if (!len)
+        return 0;
+    last = (end - 1) / quantum;
+    for (q = off / quantum; q <= last; q++)
+        if (!xa_load(&kv->live, q) && xa_err(xa_store(&kv->live, q, xa_mk_value(0), GFP_KERNEL)))
+            return -ENOMEM;
+    for (q = off / quantum; q <= last; q++) {
+        old = xa_load(&kv->live, q);
+        xa_store(&kv->live, q, xa_mk_value(xa_to_value(old) +
+                 min_t(long, end, (q + 1) * quantum) - max_t(long, off, q * quantum)), GFP_KERNEL);
+    }
+    return 0;
+}
+
+/*
+ * File data written past the last value shares the quantum it ends in,
+ * if that is not full. Called with kv->lock held.
+ */
+
+static void scull_kv_share(struct scull_dev *dev, struct scull_kv *kv) {
+    unsigned long q = (long) kv->tail / dev->quantum;
+
+    if (atomic_long_read(&dev->size) > kv->tail && (long) kv->tail % dev->quantum &&
+        xa_load(&kv->live, q))
+        xa_set_mark(&kv->live, q, SCULL_KV_SHARED);
+}
+
+/*
+ * Forget the bytes of a value that is gone (if they were counted), and
+ * punch out the quanta left holding nothing live, shared ones aside.
+ * Called with kv->lock and the write side of the semaphore held.
+ */
+
+static void scull_kv_discharge(struct scull_dev *dev, struct scull_kv *kv, long off, u32 len, int counted) {
+    int quantum = dev->quantum;
+    long end = off + len, run = -1;
+    unsigned long q, last, left;
+    int shared = 0;
+
+    if (!len)
+        return;
+    last = (end - 1) / quantum;
+    for (q = off / quantum; q <= last; q++) {
+        left = xa_to_value(xa_load(&kv->live, q));
+        if (counted)
+            left -= min_t(long, end, (q + 1) * quantum) - max_t(long, off, q * quantum);
+        if (left) {
+            xa_store(&kv->live, q, xa_mk_value(left), GFP_KERNEL);
+        } else {
+            shared = xa_get_mark(&kv->live, q, SCULL_KV_SHARED);
+            xa_erase(&kv->live, q);
+        }
+        if (left || shared) {
+            if (run >= 0)
+                scull_punch(dev, run, q * quantum - run);
+            run = -1;
+            continue;
+        }
+        if (run < 0)
+            run = q * quantum;
+    }
+    // one call per run of dead quanta, so whole list items go at once
+    if (run >= 0)
+        scull_punch(dev, run, (last + 1) * quantum - run);
+}
+
+/*
+ * Drop a value replaced, deleted or not fully put, under kv->lock.
+ * Unless data was dropped from the device in between, its quanta are
+ * ours to punch; our own punches bump the epoch too, and the index
+ * moves along with them. The value is out of the table already, so
+ * there is no backing out on a signal.
+ */
+
+static void scull_kv_drop(struct scull_dev *dev, struct scull_kv *kv, loff_t off, u32 len, int counted) {
+    down_write(&dev->sem);
+    if (kv->epoch == dev->epoch) {
+        scull_kv_discharge(dev, kv, off, len, counted);
+        smp_store_release(&kv->epoch, dev->epoch);
+    }
+    up_write(&dev->sem);
+    scull_notify(dev, off, len);
+}
+
+long scull_kv_get(struct scull_file *sf, struct scull_kv_op __user *uop) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_kv *kv = dev->kv;
+    struct scull_kv_entry *e;
+    struct scull_kv_key key;
+    struct scull_kv_op op;
+    loff_t offset;
+    u32 len, charged, moved = 0;
+    unsigned long rates;
+    long retval;
+
+    retval = scull_kv_op(uop, &op, &key);
+    if (retval)
+        return retval;
+    charged = op.len;
+    retval = scull_qos_admit(sf, 1, charged, &rates);
+    if (retval)
+        return retval;
+
+    if (down_read_interruptible(&dev->sem)) {
+        scull_qos_done(sf, rates, charged, 0);
+        return -ERESTARTSYS;
+    }
+    retval = -ENOENT;
+    if (smp_load_acquire(&kv->epoch) != dev->epoch)
+        goto out; // data dropped, nothing put since
+    rcu_read_lock();
+    e = rhashtable_lookup_fast(&kv->ht, &key, scull_kv_params);
+    if (e) {
+        offset = e->offset;
+        len = e->len;
+    }
+    rcu_read_unlock();
+    if (!e)
+        goto out;
+
+    /*
+     * The entry may be replaced from here on, but its value stays in
+     * place: punching it takes the semaphore we hold.
+     */
+    retval = 0;
+    if (op.len && op.len < len)
+        retval = -ERANGE;
+    else if (op.len)
+        retval = scull_kv_xfer(sf, u64_to_user_ptr(op.val), offset, len, 0);
+    if (op.len && !retval)
+        moved = len;
+    op.len = len;
+
+out:
+    up_read(&dev->sem);
+    scull_qos_done(sf, rates, charged, moved);
+    if ((!retval || retval == -ERANGE) && put_user(op.len, &uop->len))
+        return -EFAULT;
+    return retval;
+}
+
+long scull_kv_put(struct scull_file *sf, struct scull_kv_op __user *uop) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_kv *kv = dev->kv;
+    struct scull_kv_entry *e, *old;
+    struct scull_kv_op op;
+    long size, offset, retval, moved = 0;
+    unsigned long rates;
+
+    e = kmalloc(sizeof(struct scull_kv_entry), GFP_KERNEL);
+    if (!e)
+        return -ENOMEM;
+    memset(e, 0, sizeof(struct scull_kv_entry));
+    retval = scull_kv_op(uop, &op, &e->key);
+    if (retval)
+        goto fail;
+    retval = -EINVAL;
+    if (op.flags & ~(SCULL_KV_CREATE | SCULL_KV_REPLACE) ||
+        op.flags == (SCULL_KV_CREATE | SCULL_KV_REPLACE))
+        goto fail;
+    e->len = op.len;
+    retval = scull_qos_admit(sf, 1, op.len, &rates);
+    if (retval)
+        goto fail;
+
+    if (mutex_lock_interruptible(&kv->lock)) {
+        retval = -ERESTARTSYS;
+        goto settle;
+    }
+    if (down_read_interruptible(&dev->sem)) {
+        retval = -ERESTARTSYS;
+        goto unlock;
+    }
+    scull_kv_sync(dev, kv);
+    old = rhashtable_lookup_fast(&kv->ht, &e->key, scull_kv_params);
+    retval = -EEXIST;
+    if (old && (op.flags & SCULL_KV_CREATE))
+        goto up;
+    retval = -ENOENT;
+    if (!old && (op.flags & SCULL_KV_REPLACE))
+        goto up;
+
+    // past any file data, from a fresh quantum
+    scull_kv_share(dev, kv);
+    size = atomic_long_read(&dev->size);
+    offset = kv->tail;
+    if (size > offset)
+        offset = roundup(size, dev->quantum);
+    retval = -EFBIG;
+    if (offset > LLONG_MAX - op.len)
+        goto up;
+    e->offset = offset;
+    retval = scull_kv_xfer(sf, u64_to_user_ptr(op.val), offset, op.len, 1);
+    if (!retval)
+        retval = scull_kv_charge(kv, dev->quantum, offset, op.len);
+    if (retval) {
+        // whatever got written sits in quanta nothing points into
+        up_read(&dev->sem);
+        scull_kv_drop(dev, kv, offset, op.len, 0);
+        goto unlock;
+    }
+    moved = op.len;
+    if (old) {
+        rhashtable_replace_fast(&kv->ht, &old->node, &e->node, scull_kv_params);
+        list_del(&old->list);
+    } else {
+        retval = rhashtable_insert_fast(&kv->ht, &e->node, scull_kv_params);
+        if (retval) {
+            old = e; // its bytes are counted, uncount them below
+            e = NULL;
+        }
+    }
+    if (e) {
+        list_add(&e->list, &kv->entries);
+        kv->tail = offset + op.len;
+    }
+    up_read(&dev->sem);
+    scull_notify(dev, offset, op.len);
+    if (old) {
+        scull_kv_drop(dev, kv, old->offset, old->len, 1);
+        kfree_rcu(old, rcu);
+    }
+    mutex_unlock(&kv->lock);
+    scull_qos_done(sf, rates, op.len, moved);
+    return retval;
+
+up:
+    up_read(&dev->sem);
+unlock:
+    mutex_unlock(&kv->lock);
+settle:
+    scull_qos_done(sf, rates, op.len, moved);
+fail:
+    kfree(e);
+    return retval;
+}
+
+long scull_kv_del(struct scull_file *sf, struct scull_kv_op __user *uop) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_kv *kv = dev->kv;
+    struct scull_kv_entry *e;
+    struct scull_kv_key key;
+    struct scull_kv_op op;
+    long retval;
+
+    retval = scull_kv_op(uop, &op, &key);
+    if (retval)
+        return retval;
+
+    if (mutex_lock_interruptible(&kv->lock))
+        return -ERESTARTSYS;
+    if (down_read_interruptible(&dev->sem)) {
+        retval = -ERESTARTSYS;
+        goto out;
+    }
+    scull_kv_sync(dev, kv);
+    scull_kv_share(dev, kv);
+    e = rhashtable_lookup_fast(&kv->ht, &key, scull_kv_params);
+    if (e) {
+        rhashtable_remove_fast(&kv->ht, &e->node, scull_kv_params);
+        list_del(&e->list);
+    }
+    up_read(&dev->sem);
+    retval = -ENOENT;
+    if (e) {
+        scull_kv_drop(dev, kv, e->offset, e->len, 1);
+        kfree_rcu(e, rcu);
+        retval = 0;
+    }
+
+out:
+    mutex_unlock(&kv->lock);
+    return retval;
+}
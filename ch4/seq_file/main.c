@@ -0,0 +1,1192 @@
+#include <linux/init.h> // module_init and exit
+#include <linux/module.h>
+#include <linux/moduleparam.h> // module_param
+#include <linux/mutex.h>
+
+#include <linux/cdev.h>   // cdev definition
+#include <linux/err.h>    // ERR_PTR
+#include <linux/fs.h>     // register_chrdev_region, file_operations, everything
+#include <linux/kdev_t.h> // macros MAJOR, MINOR, MKDEV...
+#include <linux/kernel.h> // printk, u64_to_user_ptr
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/math64.h> // div_u64
+#include <linux/mm.h> // virt_to_page, page_to_nid
+#include <linux/nodemask.h> // node_online
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/proc_fs.h>
+#include <linux/rwsem.h>
+#include <linux/sched.h> // current->
+#include <linux/seq_file.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>  // kmalloc(),kfree()
+#include <linux/spinlock.h>
+#include <linux/types.h> // dev_t type
+#include <linux/uaccess.h> // get_user, put_user
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "scull.h"
+
+int scull_major = SCULL_MAJOR;
+int scull_minor = 0;
+int scull_nr_devs = SCULL_NR_DEVS;
+int scull_quantum = SCULL_QUANTUM;
+int scull_qset = SCULL_QSET;
+
+module_param(scull_major, int, S_IRUGO);
+module_param(scull_minor, int, S_IRUGO);
+module_param(scull_nr_devs, int, S_IRUGO);
+module_param(scull_quantum, int, S_IRUGO);
+module_param(scull_qset, int, S_IRUGO);
+
+// SCULL_IOCSQUANTUM and SCULL_IOCSQSET check the pair they leave behind
+static DEFINE_MUTEX(scull_geometry_lock);
+
+/*
+ * Quantum layout, one of SCULL_ALIGN_*. Writable at run time through
+ * sysfs; like the geometry, a device picks it up on its next trim.
+ */
+int scull_aligned = SCULL_ALIGN_NONE;
+
+module_param(scull_aligned, int, S_IRUGO | S_IWUSR);
+
+/*
+ * Checksum quanta with CRC32C, and verify them every scull_scrub_secs
+ * seconds in the background (0: never). To keep writes at full speed, a
+ * block is only summed on its first read or scrub after it changed:
+ * whatever befalls it before that goes unnoticed. A device starts or
+ * stops checksumming on its next trim.
+ */
+int scull_crc = 0;
+static int scull_scrub_secs = 0;
+
+module_param(scull_crc, int, S_IRUGO | S_IWUSR);
+module_param(scull_scrub_secs, int, S_IRUGO);
+
+/*
+ * Reads and writes of at least this many bytes pin the user buffer and
+ * copy straight between its pages and the quanta (0: never).
+ */
+static int scull_direct_min = SCULL_DIRECT_MIN;
+
+module_param(scull_direct_min, int, S_IRUGO | S_IWUSR);
+
+/*
+ * NUMA node of each device: scull_node=0,0,1,1 keeps scull0 and scull1
+ * on node 0 and the others on node 1. Devices not listed are allocated
+ * wherever the allocating task happens to run.
+ */
+static int scull_node[SCULL_NR_NODE_PARAMS] = {[0 ... SCULL_NR_NODE_PARAMS - 1] = NUMA_NO_NODE};
+static int scull_node_count;
+
+module_param_array(scull_node, int, &scull_node_count, S_IRUGO);
+
+/*
+ * Devices made at run time through configfs (see config.c), at most
+ * scull_max_devs of them, get minors of their own after the scullring
+ * ones.
+ */
+static int scull_max_devs = SCULL_MAX_DEVS;
+
+module_param(scull_max_devs, int, S_IRUGO);
+
+/*
+ * One slot per device: the scull_nr_devs made at load time, then those
+ * made at run time, NULL while free. The table holds a reference on
+ * every device in it; scull_devices_lock guards it and the references
+ * taken through it.
+ */
+struct scull_dev **scull_devices;
+static int scull_nr_slots;
+static DEFINE_MUTEX(scull_devices_lock);
+static dev_t scull_dyn_devno; // first minor of the run-time devices
+static int scull_dyn_count;   // and how many we got
+
+
+#ifdef SCULL_DEBUG
+
+/*
+ * Here are our sequence iteration methods.  Our "position" is
+ * simply the device number.
+ */
+
+static void *scull_seq_find(loff_t *pos) {
+    for (; *pos < scull_nr_slots; (*pos)++)
+        if (scull_devices[*pos])
+            return scull_devices[*pos];
+    return NULL;
+}
+
+static void *scull_seq_start(struct seq_file *s, loff_t *pos) {
+    mutex_lock(&scull_devices_lock); // no device goes away under us
+    return scull_seq_find(pos);
+}
+
+static void *scull_seq_next(struct seq_file *s, void *v, loff_t *pos) {
+    (*pos)++;
+    return scull_seq_find(pos);
+}
+
+static void scull_seq_stop(struct seq_file *s, void *v) {
+    mutex_unlock(&scull_devices_lock);
+}
+
+static int scull_seq_show(struct seq_file *s, void *v) {
+    struct scull_dev *dev = (struct scull_dev *) v;
+    struct scull_stats stats;
+    struct scull_qset *d;
+    struct scull_qos qos;
+    int i;
+
+    if (down_write_killable(&dev->sem))
+        return -ERESTARTSYS;
+    scull_get_stats(dev, &stats);
+    seq_printf(s, "\nDevice %i: qset %i, q %i, sz %li, node %i, discardable %li, mem %li/%li\n",
+               dev->index, dev->qset, dev->quantum, atomic_long_read(&dev->size),
+               dev->node, atomic_long_read(&dev->nr_discardable),
+               atomic_long_read(&dev->mem), dev->limit);
+    if (dev->crc)
+        seq_printf(s, "  crc: %llu blocks checked, %llu mismatches\n",
+                   stats.checked, stats.crc_errors);
+    if (scull_kv_count(dev))
+        seq_printf(s, "  kv: %u keys\n", scull_kv_count(dev));
+    scull_qos_get(dev, &qos);
+    if (qos.bps || qos.iops || qos.throttled)
+        seq_printf(s, "  qos: %llu B/s, %llu ops/s, %llu throttled, %llu us waited\n",
+                   qos.bps, qos.iops, qos.throttled, div_u64(qos.wait_ns, NSEC_PER_USEC));
+    list_for_each_entry(d, &dev->qsets, list) {
+        seq_printf(s, "  item %li at %p, qset at %p\n", d->item, d, d->data);
+        // dump only the last item
+        if (d->data && list_is_last(&d->list, &dev->qsets))
+            for (i = 0; i < dev->qset; i++) {
+                if (d->data[i])
+                    seq_printf(s, "    % 4i: %8p\n",
+                               i, d->data[i]);
+            }
+    }
+    up_write(&dev->sem);
+    return 0;
+}
+
+/*
+ * Tie the sequence operators up.
+ */
+
+static struct seq_operations scull_seq_ops = {
+        .start = scull_seq_start,
+        .next = scull_seq_next,
+        .stop = scull_seq_stop,
+        .show = scull_seq_show,
+};
+
+/*
+ * Per-node placement: count the quanta of each device by the node
+ * their memory actually lives on.
+ */
+
+static int scull_numa_seq_show(struct seq_file *s, void *v) {
+    struct scull_dev *dev = (struct scull_dev *) v;
+    struct scull_qset *d;
+    unsigned long *count;
+    int i, nid;
+
+    count = kcalloc(nr_node_ids, sizeof(*count), GFP_KERNEL);
+    if (!count)
+        return -ENOMEM;
+    if (down_write_killable(&dev->sem)) {
+        kfree(count);
+        return -ERESTARTSYS;
+    }
+    list_for_each_entry(d, &dev->qsets, list) {
+        if (!d->data)
+            continue;
+        for (i = 0; i < dev->qset; i++)
+            if (d->data[i])
+                count[page_to_nid(virt_to_page(d->data[i]))]++;
+    }
+    seq_printf(s, "\nDevice %i: node %i, struct on node %i\n", dev->index,
+               dev->node, page_to_nid(virt_to_page(dev)));
+    for_each_node(nid)
+        if (count[nid])
+            seq_printf(s, "  node %4i: %8lu quanta\n", nid, count[nid]);
+    up_write(&dev->sem);
+    kfree(count);
+    return 0;
+}
+
+static struct seq_operations scull_numa_seq_ops = {
+        .start = scull_seq_start,
+        .next = scull_seq_next,
+        .stop = scull_seq_stop,
+        .show = scull_numa_seq_show,
+};
+
+/*
+ * Now to implement the /proc files we need only make an open
+ * method which sets up the sequence operators.
+ */
+
+static int scullseq_proc_open(struct inode *inode, struct file *file) {
+    return seq_open(file, &scull_seq_ops);
+}
+
+static int scullnuma_proc_open(struct inode *inode, struct file *file) {
+    return seq_open(file, &scull_numa_seq_ops);
+}
+
+/*
+ * Create a set of file operations for our proc files.
+ */
+
+static struct file_operations scullseq_proc_ops = {
+        .owner = THIS_MODULE,
+        .open = scullseq_proc_open,
+        .read = seq_read,
+        .llseek = seq_lseek,
+        .release = seq_release,
+};
+
+static struct file_operations scullnuma_proc_ops = {
+        .owner = THIS_MODULE,
+        .open = scullnuma_proc_open,
+        .read = seq_read,
+        .llseek = seq_lseek,
+        .release = seq_release,
+};
+
+static void scull_create_proc(void) {
+    proc_create("scullseq", 0, NULL, proc_ops_wrapper(&scullseq_proc_ops, scullseq_pops));
+    proc_create("scullnuma", 0, NULL, proc_ops_wrapper(&scullnuma_proc_ops, scullnuma_pops));
+}
+
+static void scull_remove_proc(void) {
+    // no problem if it was not registered
+    remove_proc_entry("scullseq", NULL);
+    remove_proc_entry("scullnuma", NULL);
+}
+
+
+#endif // SCULL_DEBUG
+
+/*
+ * Device lifetime. A device is freed, data and all, once it has left
+ * the table and its last file is closed; a device removed at run time
+ * thus keeps serving the files open on it.
+ */
+
+static int scull_slot(dev_t devno) {
+    if (devno - MKDEV(scull_major, scull_minor) < scull_nr_devs)
+        return devno - MKDEV(scull_major, scull_minor);
+    if (scull_dyn_count && devno - scull_dyn_devno < scull_dyn_count)
+        return scull_nr_devs + devno - scull_dyn_devno;
+    return -1;
+}
+
+static struct scull_dev *scull_dev_get(dev_t devno) {
+    struct scull_dev *dev = NULL;
+    int slot = scull_slot(devno);
+
+    mutex_lock(&scull_devices_lock);
+    if (slot >= 0 && scull_devices[slot]) {
+        dev = scull_devices[slot];
+        kref_get(&dev->ref);
+    }
+    mutex_unlock(&scull_devices_lock);
+    return dev;
+}
+
+static void scull_dev_release(struct kref *ref) {
+    struct scull_dev *dev = container_of(ref, struct scull_dev, ref);
+
+    scull_trim(dev);
+    scull_kv_free(dev);
+    scull_qos_free(dev);
+    free_percpu(dev->stats);
+    kfree(dev);
+}
+
+void scull_dev_put(struct scull_dev *dev) {
+    kref_put(&dev->ref, scull_dev_release);
+}
+
+/*
+ * Open and close
+ */
+
+int scull_open(struct inode *inode, struct file *filp) {
+    // device information
+    struct scull_dev *dev;
+    struct scull_file *sf;
+    long size;
+
+    printk(KERN_INFO "scull: open\n");
+
+
+    dev = scull_dev_get(inode->i_rdev);
+    if (!dev)
+        return -ENODEV; // removed since the inode was looked up
+    sf = kmalloc(sizeof(struct scull_file), GFP_KERNEL);
+    if (!sf) {
+        scull_dev_put(dev);
+        return -ENOMEM;
+    }
+    memset(sf, 0, sizeof(struct scull_file));
+    sf->dev = dev;
+    spin_lock_init(&sf->lock);
+    sf->next_pos = -1;
+
+    // now trim to 0 the length of the device if open was write-only
+    if ((filp->f_flags & O_ACCMODE) == O_WRONLY) {
+        if (down_write_killable(&dev->sem)) {
+            kfree(sf);
+            scull_dev_put(dev);
+            return -ERESTARTSYS;
+        }
+        size = atomic_long_read(&dev->size);
+        scull_trim(dev); //ignore errors
+        up_write(&dev->sem);
+        scull_notify(dev, 0, size);
+    }
+    //for other methods
+    filp->private_data = sf;
+    return 0;
+}
+
+int scull_release(struct inode *inode, struct file *filp) {
+    struct scull_file *sf = filp->private_data;
+
+    printk(KERN_INFO "scull: release\n");
+    scull_watch_release(sf);
+    scull_dev_put(sf->dev);
+    kfree(sf);
+    return 0;
+}
+
+ssize_t scull_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_file *sf = filp->private_data;
+    struct scull_dev *dev = sf->dev;
+    unsigned long rates;
+    ssize_t retval;
+
+    pr_debug("scull: read\n");
+
+    retval = scull_qos_admit(sf, 1, count, &rates);
+    if (retval)
+        return retval;
+    if (down_read_interruptible(&dev->sem)) {
+        scull_qos_done(sf, rates, count, 0);
+        return -ERESTARTSYS;
+    }
+    if (scull_direct_min > 0 && count >= scull_direct_min)
+        retval = scull_direct_read(sf, buf, count, f_pos);
+    else
+        retval = scull_do_read(sf, buf, count, f_pos);
+    up_read(&dev->sem);
+    scull_qos_done(sf, rates, count, retval);
+    return retval;
+}
+
+ssize_t scull_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_file *sf = filp->private_data;
+    struct scull_dev *dev = sf->dev;
+    unsigned long rates;
+    ssize_t retval;
+
+    pr_debug("scull: write\n");
+
+    retval = scull_qos_admit(sf, 1, count, &rates);
+    if (retval)
+        return retval;
+    if (down_read_interruptible(&dev->sem)) {
+        scull_qos_done(sf, rates, count, 0);
+        return -ERESTARTSYS;
+    }
+    if (scull_direct_min > 0 && count >= scull_direct_min)
+        retval = scull_direct_write(sf, buf, count, f_pos);
+    else
+        retval = scull_do_write(sf, buf, count, f_pos);
+    up_read(&dev->sem);
+    scull_qos_done(sf, rates, count, retval);
+    if (retval > 0)
+        scull_notify(dev, *f_pos - retval, retval);
+    return retval;
+}
+
+/*
+ * Run a whole array of positional reads and writes under a single hold
+ * of the device semaphore. Every entry is carried out in full (or until EOF,
+ * a hole or an error) and gets its own result; f_pos is left alone.
+ * An entry with unknown flags, a range past LLONG_MAX, or one the file
+ * was not opened for, stops the batch before its chunk runs, and done
+ * tells how far it got.
+ */
+
+static int scull_batch(struct scull_file *sf, fmode_t mode, struct scull_batch __user *ubatch) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_batch batch;
+    struct scull_batch_op __user *uops;
+    struct scull_batch_op *ops;
+    char __user *buf;
+    unsigned int i, n, chunk;
+    ssize_t ret;
+    size_t left, moved = 0;
+    unsigned long rates;
+    loff_t pos;
+    int retval = 0;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    if (batch.nr > SCULL_BATCH_MAX)
+        return -E2BIG;
+    batch.done = 0;
+
+    ops = kmalloc(SCULL_BATCH_CHUNK * sizeof(*ops), GFP_KERNEL);
+    if (!ops)
+        return -ENOMEM;
+
+    // the bytes are only known once done, and charged then
+    retval = scull_qos_admit(sf, batch.nr, 0, &rates);
+    if (retval) {
+        kfree(ops);
+        return retval;
+    }
+    uops = u64_to_user_ptr(batch.ops);
+    if (down_read_interruptible(&dev->sem)) {
+        kfree(ops);
+        return -ERESTARTSYS;
+    }
+    while (batch.done < batch.nr) {
+        chunk = min(batch.nr - batch.done, (__u32) SCULL_BATCH_CHUNK);
+        if (copy_from_user(ops, uops + batch.done, chunk * sizeof(*ops))) {
+            retval = -EFAULT;
+            break;
+        }
+        // entries are checked before any of the chunk is carried out
+        for (i = 0; i < chunk; i++) {
+            if (ops[i].flags & ~SCULL_BATCH_WRITE)
+                retval = -EINVAL;
+            else if (ops[i].offset > LLONG_MAX || ops[i].len > LLONG_MAX - ops[i].offset)
+                retval = -EINVAL; // would be a negative position
+            else if (!(mode & (ops[i].flags & SCULL_BATCH_WRITE ? FMODE_WRITE : FMODE_READ)))
+                retval = -EBADF;
+            if (retval)
+                break;
+        }
+        if (retval)
+            break;
+        for (i = 0; i < chunk; i++) {
+            buf = u64_to_user_ptr(ops[i].buf);
+            pos = ops[i].offset;
+            left = ops[i].len;
+            n = 0;
+            ret = 0;
+            while (left) {
+                if (ops[i].flags & SCULL_BATCH_WRITE)
+                    ret = scull_do_write(sf, buf + n, left, &pos);
+                else
+                    ret = scull_do_read(sf, buf + n, left, &pos);
+                if (ret <= 0)
+                    break;
+                n += ret;
+                left -= ret;
+            }
+            // a partial transfer reports what was done, like read(2)
+            ops[i].result = n ? n : ret;
+            moved += n;
+            if (n && (ops[i].flags & SCULL_BATCH_WRITE))
+                scull_notify(dev, ops[i].offset, n);
+        }
+        if (copy_to_user(uops + batch.done, ops, chunk * sizeof(*ops))) {
+            retval = -EFAULT;
+            break;
+        }
+        batch.done += chunk;
+    }
+    up_read(&dev->sem);
+    kfree(ops);
+    scull_qos_done(sf, rates, 0, min_t(size_t, moved, LONG_MAX));
+
+    if (put_user(batch.done, &ubatch->done))
+        return -EFAULT;
+    return retval;
+}
+
+/*
+ * Export or import one chunk of a device's contents. An import replaces
+ * everything on the device: the header that starts the stream trims it
+ * down to the stream's layout and size under the write side of the
+ * semaphore, and the records are then written in like any write would.
+ * A chunk is one operation to the throttle, charged for the buffer.
+ */
+
+static int scull_stream(struct scull_file *sf, struct scull_stream __user *ustream, int import) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_stream_hdr hdr;
+    struct scull_stream st;
+    struct scull_range changed;
+    char __user *buf;
+    size_t charged;
+    unsigned long rates;
+    long old, ret;
+    int retval;
+
+    if (copy_from_user(&st, ustream, sizeof(st)))
+        return -EFAULT;
+    buf = u64_to_user_ptr(st.buf);
+    st.done = 0;
+    charged = min_t(u64, st.len, LONG_MAX);
+    retval = scull_qos_admit(sf, 1, charged, &rates);
+    if (retval)
+        return retval;
+
+    if (import && st.pos == 0) {
+        retval = -EINVAL;
+        if (st.len < sizeof(hdr))
+            goto out;
+        retval = -EFAULT;
+        if (copy_from_user(&hdr, buf, sizeof(hdr)))
+            goto out;
+        retval = -ERESTARTSYS;
+        if (down_write_killable(&dev->sem))
+            goto out;
+        old = atomic_long_read(&dev->size);
+        retval = scull_import_start(dev, &hdr);
+        up_write(&dev->sem);
+        if (retval)
+            goto out;
+        scull_notify(dev, 0, max_t(long, old, hdr.size));
+        st.done = sizeof(hdr);
+        st.pos = 1;
+    }
+
+    retval = -ERESTARTSYS;
+    if (down_read_interruptible(&dev->sem))
+        goto out;
+    if (import)
+        ret = scull_import(sf, buf + st.done, st.len - st.done, &st.pos, &changed);
+    else
+        ret = scull_export(sf, buf, st.len, &st.pos);
+    up_read(&dev->sem);
+    if (import && ret > 0)
+        scull_notify(dev, changed.offset, changed.len);
+    // what got through counts, like a short read(2)
+    retval = ret;
+    if (ret < 0 && !st.done)
+        goto out;
+    if (ret > 0)
+        st.done += ret;
+
+    retval = 0;
+    if (copy_to_user(ustream, &st, sizeof(st)))
+        retval = -EFAULT;
+
+out:
+    scull_qos_done(sf, rates, charged, retval ? 0 : min_t(u64, st.done, LONG_MAX));
+    return retval;
+}
+
+/*
+ * Move the allocations of a device to another NUMA node. Only new
+ * allocations move: existing quanta stay where they are.
+ */
+
+int scull_set_node(struct scull_dev *dev, int node) {
+    if (node != NUMA_NO_NODE &&
+        (node < 0 || node >= nr_node_ids || !node_online(node)))
+        return -EINVAL;
+    if (down_write_killable(&dev->sem))
+        return -ERESTARTSYS;
+    dev->node = node;
+    up_write(&dev->sem);
+    return 0;
+}
+
+/*
+ * The ioctl() implementation
+ */
+
+long scull_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct scull_file *sf = filp->private_data;
+    struct scull_dev *dev = sf->dev;
+    struct scull_stats stats;
+    struct scull_range range;
+    struct scull_qos qos;
+    __u64 size;
+    long old;
+    int node, tmp;
+    long retval = 0;
+
+    /*
+     * extract the type and number bitfields, and don't decode
+     * wrong cmds: return ENOTTY (inappropriate ioctl) before access_ok()
+     */
+    if (_IOC_TYPE(cmd) != SCULL_IOC_MAGIC)
+        return -ENOTTY;
+    if (_IOC_NR(cmd) > SCULL_IOC_MAXNR)
+        return -ENOTTY;
+
+    switch (cmd) {
+    case SCULL_IOCSNODE:
+        if (!capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        retval = get_user(node, (int __user *) arg);
+        if (retval)
+            break;
+        retval = scull_set_node(dev, node);
+        break;
+
+    case SCULL_IOCGNODE:
+        retval = put_user(dev->node, (int __user *) arg);
+        break;
+
+    case SCULL_IOCBATCH:
+        retval = scull_batch(sf, filp->f_mode, (struct scull_batch __user *) arg);
+        break;
+
+    /*
+     * Like in LDD3, the geometry is module-wide and is picked up
+     * by each device on its next trim.
+     */
+    case SCULL_IOCSQUANTUM:
+        if (!capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        retval = get_user(tmp, (int __user *) arg);
+        if (retval)
+            break;
+        mutex_lock(&scull_geometry_lock);
+        retval = scull_check_geometry(scull_layout_quantum(tmp), scull_qset);
+        if (!retval)
+            WRITE_ONCE(scull_quantum, tmp);
+        mutex_unlock(&scull_geometry_lock);
+        break;
+
+    case SCULL_IOCSQSET:
+        if (!capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        retval = get_user(tmp, (int __user *) arg);
+        if (retval)
+            break;
+        mutex_lock(&scull_geometry_lock);
+        retval = scull_check_geometry(scull_layout_quantum(scull_quantum), tmp);
+        if (!retval)
+            WRITE_ONCE(scull_qset, tmp);
+        mutex_unlock(&scull_geometry_lock);
+        break;
+
+    case SCULL_IOCGQUANTUM:
+        retval = put_user(scull_quantum, (int __user *) arg);
+        break;
+
+    case SCULL_IOCGQSET:
+        retval = put_user(scull_qset, (int __user *) arg);
+        break;
+
+    case SCULL_IOCDISCARDABLE:
+        if (!(filp->f_mode & FMODE_WRITE))
+            return -EBADF;
+        if (copy_from_user(&range, (void __user *) arg, sizeof(range)))
+            return -EFAULT;
+        if (range.offset > LLONG_MAX || range.len > LLONG_MAX - range.offset)
+            return -EINVAL;
+        if (down_write_killable(&dev->sem))
+            return -ERESTARTSYS;
+        retval = scull_mark_discardable(dev, range.offset, range.len);
+        up_write(&dev->sem);
+        break;
+
+    case SCULL_IOCPUNCH:
+        if (!(filp->f_mode & FMODE_WRITE))
+            return -EBADF;
+        if (copy_from_user(&range, (void __user *) arg, sizeof(range)))
+            return -EFAULT;
+        if (range.offset > LLONG_MAX || range.len > LLONG_MAX - range.offset)
+            return -EINVAL;
+        if (down_write_killable(&dev->sem))
+            return -ERESTARTSYS;
+        retval = scull_punch(dev, range.offset, range.len);
+        up_write(&dev->sem);
+        if (!retval)
+            scull_notify(dev, range.offset, range.len);
+        break;
+
+    case SCULL_IOCTRUNCATE:
+        if (!(filp->f_mode & FMODE_WRITE))
+            return -EBADF;
+        if (copy_from_user(&size, (void __user *) arg, sizeof(size)))
+            return -EFAULT;
+        if (size > LLONG_MAX)
+            return -EINVAL;
+        if (down_write_killable(&dev->sem))
+            return -ERESTARTSYS;
+        old = atomic_long_read(&dev->size);
+        retval = scull_truncate(dev, size);
+        up_write(&dev->sem);
+        if (!retval)
+            scull_notify(dev, min_t(u64, old, size), abs((long) size - old));
+        break;
+
+    case SCULL_IOCEVENTFD:
+        retval = get_user(tmp, (int __user *) arg);
+        if (retval)
+            break;
+        retval = scull_watch_eventfd(sf, tmp);
+        break;
+
+    case SCULL_IOCCHANGES:
+        retval = scull_watch_changes(sf, (struct scull_changes __user *) arg);
+        break;
+
+    case SCULL_IOCSCRUB:
+        if (down_read_interruptible(&dev->sem))
+            return -ERESTARTSYS;
+        retval = min(scull_scrub(dev), (unsigned long) INT_MAX);
+        up_read(&dev->sem);
+        break;
+
+    case SCULL_IOCEXPORT:
+        if (!(filp->f_mode & FMODE_READ))
+            return -EBADF;
+        retval = scull_stream(sf, (struct scull_stream __user *) arg, 0);
+        break;
+
+    case SCULL_IOCIMPORT:
+        if (!(filp->f_mode & FMODE_WRITE))
+            return -EBADF;
+        retval = scull_stream(sf, (struct scull_stream __user *) arg, 1);
+        break;
+
+    case SCULL_IOCKVGET:
+        if (!(filp->f_mode & FMODE_READ))
+            return -EBADF;
+        retval = scull_kv_get(sf, (struct scull_kv_op __user *) arg);
+        break;
+
+    case SCULL_IOCKVPUT:
+        if (!(filp->f_mode & FMODE_WRITE))
+            return -EBADF;
+        retval = scull_kv_put(sf, (struct scull_kv_op __user *) arg);
+        break;
+
+    case SCULL_IOCKVDEL:
+        if (!(filp->f_mode & FMODE_WRITE))
+            return -EBADF;
+        retval = scull_kv_del(sf, (struct scull_kv_op __user *) arg);
+        break;
+
+    case SCULL_IOCSQOS:
+        if (!capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        if (copy_from_user(&qos, (void __user *) arg, sizeof(qos)))
+            return -EFAULT;
+        retval = scull_qos_set(dev, &qos);
+        break;
+
+    case SCULL_IOCGQOS:
+        scull_qos_get(dev, &qos);
+        if (copy_to_user((void __user *) arg, &qos, sizeof(qos)))
+            retval = -EFAULT;
+        break;
+
+    /*
+     * Jumping the queue is for the privileged, like raising one's
+     * I/O priority.
+     */
+    case SCULL_IOCSPRIO:
+        retval = get_user(tmp, (int __user *) arg);
+        if (retval)
+            break;
+        if (tmp != SCULL_PRIO_NORMAL && tmp != SCULL_PRIO_HIGH)
+            return -EINVAL;
+        if (tmp == SCULL_PRIO_HIGH && !capable(CAP_SYS_NICE))
+            return -EPERM;
+        sf->prio = tmp;
+        break;
+
+    case SCULL_IOCGSTATS:
+        scull_get_stats(dev, &stats);
+        if (copy_to_user((void __user *) arg, &stats, sizeof(stats)))
+            retval = -EFAULT;
+        break;
+
+    default: // redundant, as cmd was checked against MAXNR
+        return -ENOTTY;
+    }
+    return retval;
+}
+
+/*
+ * Memory pressure: the shrinker reports how many discardable quanta the
+ * devices hold and frees them on request. A device that is busy is
+ * skipped rather than waited for, and so is the device table: a device
+ * being made may be allocating, and be the reason we are called.
+ */
+
+static unsigned long scull_shrink_count(struct shrinker *shrink, struct shrink_control *sc) {
+    unsigned long count = 0;
+    int i;
+
+    if (!mutex_trylock(&scull_devices_lock))
+        return 0;
+    for (i = 0; i < scull_nr_slots; i++)
+        if (scull_devices[i])
+            count += atomic_long_read(&scull_devices[i]->nr_discardable);
+    mutex_unlock(&scull_devices_lock);
+    return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long scull_shrink_scan(struct shrinker *shrink, struct shrink_control *sc) {
+    struct scull_dev *dev;
+    unsigned long freed = 0;
+    int i;
+
+    if (!mutex_trylock(&scull_devices_lock))
+        return SHRINK_STOP;
+    for (i = 0; i < scull_nr_slots && freed < sc->nr_to_scan; i++) {
+        dev = scull_devices[i];
+        if (!dev || !atomic_long_read(&dev->nr_discardable) || !down_write_trylock(&dev->sem))
+            continue;
+        freed += scull_reclaim(dev, sc->nr_to_scan - freed);
+        up_write(&dev->sem);
+    }
+    mutex_unlock(&scull_devices_lock);
+    return freed ? freed : SHRINK_STOP;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+
+static struct shrinker *scull_shrinker;
+
+static int scull_register_shrinker(void) {
+    scull_shrinker = shrinker_alloc(0, "scull");
+    if (!scull_shrinker)
+        return -ENOMEM;
+    scull_shrinker->count_objects = scull_shrink_count;
+    scull_shrinker->scan_objects = scull_shrink_scan;
+    scull_shrinker->seeks = DEFAULT_SEEKS;
+    shrinker_register(scull_shrinker);
+    return 0;
+}
+
+static void scull_unregister_shrinker(void) {
+    shrinker_free(scull_shrinker); // fine with NULL
+    scull_shrinker = NULL;
+}
+
+#else
+
+static struct shrinker scull_shrinker = {
+        .count_objects = scull_shrink_count,
+        .scan_objects = scull_shrink_scan,
+        .seeks = DEFAULT_SEEKS,
+};
+static bool scull_shrinker_registered;
+
+static int scull_register_shrinker(void) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+    int err = register_shrinker(&scull_shrinker, "scull");
+#else
+    int err = register_shrinker(&scull_shrinker);
+#endif
+
+    scull_shrinker_registered = !err;
+    return err;
+}
+
+static void scull_unregister_shrinker(void) {
+    if (scull_shrinker_registered)
+        unregister_shrinker(&scull_shrinker);
+    scull_shrinker_registered = false;
+}
+
+#endif
+
+/*
+ * The background scrubber: every scull_scrub_secs seconds, verify each
+ * device in turn. Mismatches are counted and logged by the scrub itself.
+ */
+
+static void scull_scrub_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(scull_scrub_work, scull_scrub_fn);
+
+static void scull_scrub_fn(struct work_struct *work) {
+    struct scull_dev *dev;
+    int i;
+
+    for (i = 0; i < scull_nr_slots; i++) {
+        mutex_lock(&scull_devices_lock);
+        dev = scull_devices[i];
+        if (dev)
+            kref_get(&dev->ref);
+        mutex_unlock(&scull_devices_lock);
+        if (!dev)
+            continue;
+        if (!down_read_interruptible(&dev->sem)) {
+            if (dev->crc)
+                scull_scrub(dev);
+            up_read(&dev->sem);
+        }
+        scull_dev_put(dev);
+    }
+    schedule_delayed_work(&scull_scrub_work, scull_scrub_secs * HZ);
+}
+
+/*
+ * Create a set of file operations for our scull files.
+ * All the functions do nothig
+ */
+
+struct file_operations scull_fops = {
+        .owner = THIS_MODULE,
+        .read = scull_read,
+        .write = scull_write,
+        .unlocked_ioctl = scull_ioctl,
+        .poll = scull_watch_poll,
+        .open = scull_open,
+        .release = scull_release,
+};
+
+/*
+ * Make a device for the given slot of scull_devices, on the given node.
+ * It starts with the module's geometry and the one reference the table
+ * will hold.
+ */
+
+static struct scull_dev *scull_dev_alloc(int index, int node) {
+    struct scull_dev *dev = kmalloc_node(sizeof(struct scull_dev), GFP_KERNEL, node);
+    int j;
+
+    if (!dev)
+        return NULL;
+    memset(dev, 0, sizeof(struct scull_dev));
+    dev->stats = alloc_percpu(struct scull_stats);
+    if (!dev->stats) {
+        kfree(dev);
+        return NULL;
+    }
+    if (scull_kv_init(dev)) {
+        free_percpu(dev->stats);
+        kfree(dev);
+        return NULL;
+    }
+    if (scull_qos_init(dev)) {
+        scull_kv_free(dev);
+        free_percpu(dev->stats);
+        kfree(dev);
+        return NULL;
+    }
+    dev->quantum = scull_layout_quantum(scull_quantum);
+    dev->qset = scull_qset;
+    dev->crc = scull_crc;
+    dev->node = node;
+    dev->index = index;
+    INIT_LIST_HEAD(&dev->qsets);
+    scull_watch_init(&dev->watch);
+    init_rwsem(&dev->sem);
+    mutex_init(&dev->list_lock);
+    for (j = 0; j < SCULL_STRIPES; j++)
+        mutex_init(&dev->stripe[j].lock);
+    kref_init(&dev->ref);
+    return dev;
+}
+
+/*
+ * Set up the char_dev structure for this device. It is allocated on its
+ * own, as the files open on it keep it around after the device is gone.
+ */
+
+static int scull_setup_cdev(struct scull_dev *dev, dev_t devno) {
+    int err;
+
+    dev->cdev = cdev_alloc();
+    if (!dev->cdev)
+        return -ENOMEM;
+    dev->cdev->ops = &scull_fops;
+    dev->cdev->owner = THIS_MODULE;
+    err = cdev_add(dev->cdev, devno, 1);
+    if (err) {
+        printk(KERN_NOTICE "Error %d adding scull%d", err, dev->index);
+        kobject_put(&dev->cdev->kobj);
+        dev->cdev = NULL;
+    }
+    return err;
+}
+
+/*
+ * Make a device at run time, in the first free slot. Called by configfs.
+ */
+
+struct scull_dev *scull_dev_create(void) {
+    struct scull_dev *dev;
+    int slot, err;
+
+    mutex_lock(&scull_devices_lock);
+    for (slot = scull_nr_devs; slot < scull_nr_slots && scull_devices[slot]; slot++)
+        ;
+    if (slot == scull_nr_slots) {
+        mutex_unlock(&scull_devices_lock);
+        return ERR_PTR(-ENOSPC);
+    }
+    dev = scull_dev_alloc(slot, NUMA_NO_NODE);
+    if (!dev) {
+        mutex_unlock(&scull_devices_lock);
+        return ERR_PTR(-ENOMEM);
+    }
+    scull_devices[slot] = dev;
+    err = scull_setup_cdev(dev, scull_dyn_devno + slot - scull_nr_devs);
+    if (err) {
+        scull_devices[slot] = NULL;
+        mutex_unlock(&scull_devices_lock);
+        scull_dev_put(dev);
+        return ERR_PTR(err);
+    }
+    mutex_unlock(&scull_devices_lock);
+    return dev;
+}
+
+/*
+ * Take a device out of the table and out of reach of new opens. It goes
+ * away with the last file still open on it.
+ */
+
+void scull_dev_remove(struct scull_dev *dev) {
+    mutex_lock(&scull_devices_lock);
+    if (dev->cdev)
+        cdev_del(dev->cdev);
+    scull_devices[dev->index] = NULL;
+    mutex_unlock(&scull_devices_lock);
+    scull_dev_put(dev);
+}
+
+/*
+ * The cleanup function is used to handle initialization failures as well.
+ * Thefore, it must be careful to work correctly even if some of the items
+ * have not been initialized
+ */
+
+void scull_cleanup_module(void) {
+    int i;
+    dev_t devno = MKDEV(scull_major, scull_minor);
+
+    // no more devices come, and nothing may look at them once they start going away
+    scull_config_exit();
+    scull_unregister_shrinker();
+    cancel_delayed_work_sync(&scull_scrub_work);
+
+    // Get rid of our char dev entries
+    if (scull_devices) {
+        for (i = 0; i < scull_nr_slots; i++)
+            if (scull_devices[i])
+                scull_dev_remove(scull_devices[i]);
+        kfree(scull_devices);
+    }
+
+#ifdef SCULL_DEBUG
+    scull_remove_proc();
+#endif // SCULL_DEBUG
+
+    // and call the cleanup functions for friend devices
+    scull_ring_cleanup();
+
+    // cleanup_module is never called if registering failed
+    if (scull_dyn_count)
+        unregister_chrdev_region(scull_dyn_devno, scull_dyn_count);
+    unregister_chrdev_region(devno, scull_nr_devs);
+}
+
+/*
+ * The init function is used to register the chdeiv allocating dinamically a
+ * new major number (if not specified at load/compilation-time)
+ */
+
+static int scull_init(void) {
+    int result, i, node;
+    dev_t dev = 0;
+
+    printk(KERN_INFO "scull: init\n");
+
+    if (scull_major) {
+        dev = MKDEV(scull_major, scull_minor);
+        result = register_chrdev_region(dev, scull_nr_devs, "scull");
+    } else {
+        result = alloc_chrdev_region(&dev, scull_minor, scull_nr_devs, "scull");
+        scull_major = MAJOR(dev);
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    // room for the run-time devices too, whether we get minors for them or not
+    scull_max_devs = max(scull_max_devs, 0);
+    scull_devices = kmalloc((scull_nr_devs + scull_max_devs) * sizeof(struct scull_dev *), GFP_KERNEL);
+    if (!scull_devices) {
+        result = -ENOMEM;
+        goto fail;
+    }
+    memset(scull_devices, 0, (scull_nr_devs + scull_max_devs) * sizeof(struct scull_dev *));
+    scull_nr_slots = scull_nr_devs;
+
+    // Initialize each device, on the node it was asked to live on.
+    for (i = 0; i < scull_nr_devs; i++) {
+        node = i < scull_node_count ? scull_node[i] : NUMA_NO_NODE;
+        if (node != NUMA_NO_NODE && (node < 0 || node >= nr_node_ids || !node_online(node))) {
+            printk(KERN_NOTICE "scull%d: node %d is not online, ignoring it\n", i, node);
+            node = NUMA_NO_NODE;
+        }
+        scull_devices[i] = scull_dev_alloc(i, node);
+        if (!scull_devices[i]) {
+            result = -ENOMEM;
+            goto fail;
+        }
+        scull_setup_cdev(scull_devices[i], MKDEV(scull_major, scull_minor + i));
+    }
+
+    result = scull_register_shrinker();
+    if (result)
+        goto fail;
+    if (scull_scrub_secs > 0)
+        schedule_delayed_work(&scull_scrub_work, scull_scrub_secs * HZ);
+
+    // At this point call the init function for any friend device
+    dev = MKDEV(scull_major, scull_minor + scull_nr_devs);
+    dev += scull_ring_init(dev);
+
+    // and take the minors that follow for devices made at run time
+    if (scull_max_devs && register_chrdev_region(dev, scull_max_devs, "scull_cfg") == 0) {
+        scull_dyn_devno = dev;
+        scull_dyn_count = scull_max_devs;
+        scull_nr_slots = scull_nr_devs + scull_dyn_count;
+        if (scull_config_init())
+            printk(KERN_NOTICE "scull: no configfs, devices can't be made at run time\n");
+    }
+
+#ifdef SCULL_DEBUG
+    scull_create_proc();
+#endif // SCULL_DEBUG
+
+    return 0;
+
+fail:
+    scull_cleanup_module();
+    return result;
+}
+
+/*
+ * The exit function is simply calls the cleanup
+ */
+
+static void scull_exit(void) {
+    printk(KERN_INFO "scull: exit\n");
+    scull_cleanup_module();
+}
+
+module_init(scull_init);
+module_exit(scull_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_AUTHOR("Mário Bezerra");
+MODULE_DESCRIPTION("testing read and write functions");
+MODULE_VERSION("1.0");
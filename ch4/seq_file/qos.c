@@ -0,0 +1,274 @@
+#include <linux/atomic.h>
+#include <linux/cred.h>      // current_fsuid
+#include <linux/hashtable.h>
+#include <linux/jiffies.h>   // nsecs_to_jiffies
+#include <linux/kernel.h>    // max
+#include <linux/ktime.h>
+#include <linux/math64.h>    // mul_u64_u64_div_u64
+#include <linux/sched.h>     // MAX_SCHEDULE_TIMEOUT
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/uidgid.h>
+#include <linux/wait.h>
+
+#include "scull.h"
+
+/*
+ * Throttling of the paths that move device data: reads, writes, batches,
+ * key-value gets and puts, export and import.
+ *
+ * A budget is kept as the time at which it runs dry, a virtual clock
+ * as in GCRA: every operation let in pushes it forward by what it costs
+ * at the configured rate, and an operation is let in once the clock is
+ * no later than now. An idle budget is never left more than burst_ms
+ * behind now, which is what may go through at once after a quiet spell.
+ * Bytes are charged up front for what was asked and the unused part is
+ * handed back afterwards, so that callers arriving together are paced
+ * at once rather than all slipping in before the first one counts.
+ *
+ * Waiters sleep on the wait queue for as long as their budget needs to
+ * catch up. Anything that may let them in earlier (new rates, a refund,
+ * the last high-priority waiter getting through) bumps seq and wakes
+ * them all for another look.
+ */
+
+struct scull_budget {
+    struct hlist_node node; // in uids, unless it is the device's
+    kuid_t uid;
+    u64 bytes_at;           // ktime_get_ns() at which the byte budget runs dry
+    u64 ops_at;             // and the operation one
+};
+
+struct scull_throttle {
+    spinlock_t lock;            // everything below but high and wait
+    struct scull_qos conf;      // rates and counters
+    struct scull_budget dev;    // the device's budget
+    DECLARE_HASHTABLE(uids, 6); // per-user budgets, with SCULL_QOS_PER_UID
+    unsigned int nr_uids;
+    unsigned long seq;          // bumped to send waiters for another look
+    unsigned long gen;          // bumped when new rates are set
+    atomic_t high;              // high-priority files waiting
+    wait_queue_head_t wait;
+};
+
+int scull_qos_init(struct scull_dev *dev) {
+    struct scull_throttle *t = kmalloc(sizeof(struct scull_throttle), GFP_KERNEL);
+
+    if (!t)
+        return -ENOMEM;
+    memset(t, 0, sizeof(struct scull_throttle));
+    spin_lock_init(&t->lock);
+    hash_init(t->uids);
+    atomic_set(&t->high, 0);
+    init_waitqueue_head(&t->wait);
+    dev->throttle = t;
+    return 0;
+}
+
+static void scull_qos_drop_uids(struct scull_throttle *t) {
+    struct scull_budget *b;
+    struct hlist_node *next;
+    int bkt;
+
+    hash_for_each_safe(t->uids, bkt, next, b, node) {
+        hash_del(&b->node);
+        kfree(b);
+    }
+    t->nr_uids = 0;
+}
+
+void scull_qos_free(struct scull_dev *dev) {
+    if (!dev->throttle)
+        return;
+    scull_qos_drop_uids(dev->throttle);
+    kfree(dev->throttle);
+    dev->throttle = NULL;
+}
+
+static void scull_qos_kick(struct scull_throttle *t) {
+    spin_lock(&t->lock);
+    t->seq++;
+    spin_unlock(&t->lock);
+    wake_up_all(&t->wait);
+}
+
+/*
+ * The budget the caller draws on. A user seen for the first time gets
+ * the spare one, if the caller had one ready; if not, NULL tells it to
+ * allocate one and come back. Past SCULL_QOS_UIDS users, the newcomers
+ * share the device's budget.
+ */
+
+static struct scull_budget *scull_qos_budget(struct scull_throttle *t, kuid_t uid,
+                                             struct scull_budget **spare) {
+    struct scull_budget *b;
+
+    if (!(t->conf.flags & SCULL_QOS_PER_UID))
+        return &t->dev;
+    hash_for_each_possible(t->uids, b, node, __kuid_val(uid))
+        if (uid_eq(b->uid, uid))
+            return b;
+    if (t->nr_uids >= SCULL_QOS_UIDS)
+        return &t->dev;
+    if (!spare || !*spare)
+        return NULL;
+    b = *spare;
+    *spare = NULL;
+    memset(b, 0, sizeof(*b));
+    b->uid = uid;
+    hash_add(t->uids, &b->node, __kuid_val(uid));
+    t->nr_uids++;
+    return b;
+}
+
+/*
+ * Move a virtual clock by the cost of n units (a refund when negative)
+ */
+
+static u64 scull_qos_advance(u64 at, u64 floor, long n, u64 rate) {
+    u64 cost = mul_u64_u64_div_u64(n < 0 ? -n : n, NSEC_PER_SEC, rate);
+
+    if (n < 0)
+        return at > cost ? at - cost : 0;
+    return max(at, floor) + cost;
+}
+
+static void scull_qos_charge(struct scull_throttle *t, struct scull_budget *b, u64 now,
+                             long ops, long bytes) {
+    u64 burst = (u64) t->conf.burst_ms * NSEC_PER_MSEC;
+    u64 floor = now > burst ? now - burst : 0;
+
+    if (t->conf.bps)
+        b->bytes_at = scull_qos_advance(b->bytes_at, floor, bytes, t->conf.bps);
+    if (t->conf.iops)
+        b->ops_at = scull_qos_advance(b->ops_at, floor, ops, t->conf.iops);
+}
+
+/*
+ * Wait until ops operations moving up to bytes bytes fit in the budget,
+ * and charge them to it. The rates they were charged at are returned in
+ * gen, for scull_qos_done. Called without the device semaphore held.
+ */
+
+int scull_qos_admit(struct scull_file *sf, long ops, size_t bytes, unsigned long *gen) {
+    struct scull_throttle *t = sf->dev->throttle;
+    struct scull_budget *b, *spare = NULL;
+    int high = sf->prio == SCULL_PRIO_HIGH;
+    u64 now, at, start = 0;
+    unsigned long seq;
+    long timeout;
+    int retval = 0;
+
+    *gen = READ_ONCE(t->gen);
+    if (!READ_ONCE(t->conf.bps) && !READ_ONCE(t->conf.iops))
+        return 0;
+    if (high)
+        atomic_inc(&t->high);
+    for (;;) {
+        spin_lock(&t->lock);
+        b = scull_qos_budget(t, current_fsuid(), &spare);
+        if (!b) {
+            spin_unlock(&t->lock);
+            spare = kmalloc(sizeof(struct scull_budget), GFP_KERNEL);
+            if (!spare) {
+                retval = -ENOMEM;
+                break;
+            }
+            continue;
+        }
+        now = ktime_get_ns();
+        at = max(b->bytes_at, b->ops_at);
+        seq = t->seq;
+        if (at <= now && (high || !atomic_read(&t->high))) {
+            scull_qos_charge(t, b, now, ops, min_t(size_t, bytes, LONG_MAX));
+            *gen = t->gen;
+            if (start) {
+                t->conf.throttled++;
+                t->conf.wait_ns += now - start;
+            }
+            spin_unlock(&t->lock);
+            break;
+        }
+        if (!start)
+            start = now;
+        spin_unlock(&t->lock);
+
+        // behind high-priority waiters, wait for them to get through
+        timeout = MAX_SCHEDULE_TIMEOUT;
+        if (at > now)
+            timeout = min_t(u64, nsecs_to_jiffies(at - now) + 1, MAX_SCHEDULE_TIMEOUT);
+        if (wait_event_interruptible_timeout(t->wait, READ_ONCE(t->seq) != seq, timeout) < 0) {
+            retval = -ERESTARTSYS;
+            break;
+        }
+    }
+    kfree(spare);
+    if (high && atomic_dec_and_test(&t->high))
+        scull_qos_kick(t);
+    return retval;
+}
+
+/*
+ * Settle the bytes of an operation once it is over: charged were paid
+ * for up front and moved went through (none, on an error). What was not
+ * used is handed back, and what was not known up front is charged. New
+ * rates since admission (gen) started the budgets afresh, and there is
+ * nothing left to hand back.
+ */
+
+void scull_qos_done(struct scull_file *sf, unsigned long gen, size_t charged, long moved) {
+    struct scull_throttle *t = sf->dev->throttle;
+    struct scull_budget *b;
+    long bytes = max(moved, 0L) - (long) charged;
+
+    if (!bytes || !READ_ONCE(t->conf.bps))
+        return;
+    spin_lock(&t->lock);
+    if (bytes < 0 && gen != t->gen) {
+        spin_unlock(&t->lock);
+        return;
+    }
+    b = scull_qos_budget(t, current_fsuid(), NULL);
+    if (b)
+        scull_qos_charge(t, b, ktime_get_ns(), 0, bytes);
+    spin_unlock(&t->lock);
+    if (bytes < 0 && waitqueue_active(&t->wait))
+        scull_qos_kick(t);
+}
+
+/*
+ * New rates start every budget afresh
+ */
+
+int scull_qos_set(struct scull_dev *dev, const struct scull_qos *conf) {
+    struct scull_throttle *t = dev->throttle;
+    struct scull_budget *b;
+    int bkt;
+
+    if (conf->flags & ~SCULL_QOS_PER_UID || conf->burst_ms > SCULL_QOS_BURST_MAX)
+        return -EINVAL;
+    spin_lock(&t->lock);
+    t->conf.bps = conf->bps;
+    t->conf.iops = conf->iops;
+    t->conf.burst_ms = conf->burst_ms;
+    t->conf.flags = conf->flags;
+    t->dev.bytes_at = t->dev.ops_at = 0;
+    if (conf->flags & SCULL_QOS_PER_UID) {
+        hash_for_each(t->uids, bkt, b, node)
+            b->bytes_at = b->ops_at = 0;
+    } else {
+        scull_qos_drop_uids(t);
+    }
+    t->seq++;
+    t->gen++;
+    spin_unlock(&t->lock);
+    wake_up_all(&t->wait);
+    return 0;
+}
+
+void scull_qos_get(struct scull_dev *dev, struct scull_qos *conf) {
+    spin_lock(&dev->throttle->lock);
+    *conf = dev->throttle->conf;
+    spin_unlock(&dev->throttle->lock);
+}
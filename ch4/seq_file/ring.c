@@ -0,0 +1,409 @@
+#include <linux/module.h>
+#include <linux/moduleparam.h> // module_param
+
+#include <linux/cdev.h>   // cdev definition
+#include <linux/fs.h>     // register_chrdev_region, file_operations, everything
+#include <linux/kernel.h> // printk, min_t
+#include <linux/kfifo.h>  // lock-free single producer/single consumer fifo
+#include <linux/log2.h>   // roundup_pow_of_two
+#include <linux/percpu.h> // alloc_percpu, get_cpu_ptr
+#include <linux/poll.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h> // current->
+#include <linux/seq_file.h>
+#include <linux/slab.h> // kmalloc(),kfree()
+#include <linux/types.h>
+#include <linux/uaccess.h> // copy_from_user
+#include <linux/wait.h>
+
+#include "scull.h"
+
+/*
+ * A scullring device is a multi-producer, single-consumer message queue.
+ *
+ * Every CPU owns a private ring. A writer copies its payload into kernel
+ * memory first, then disables preemption and appends one length-prefixed
+ * record to the ring of the CPU it runs on. With preemption off that CPU
+ * has exactly one producer, so the append needs neither a lock nor an
+ * atomic instruction: kfifo publishes the record with a single store to
+ * its "in" index once the data is in place.
+ *
+ * Readers are serialised by a mutex and drain as many records as fit in
+ * their buffer, going round the CPUs one record at a time.
+ *
+ * Ordering guarantee:
+ *  - the bytes of one write() are never interleaved with the bytes of
+ *    another write(), although a small read buffer may split them across
+ *    several read() calls;
+ *  - two writes issued on the same CPU are read in the order they were
+ *    issued (in particular, writes from a task pinned to one CPU are FIFO);
+ *  - writes issued on different CPUs have no defined relative order.
+ * A write() larger than a ring is truncated to the largest record that
+ * fits, and is accepted whole or not at all.
+ */
+
+static int scull_ring_nr_devs = SCULL_RING_NR_DEVS;
+static int scull_ring_size = SCULL_RING_SIZE;
+
+module_param(scull_ring_nr_devs, int, S_IRUGO);
+module_param(scull_ring_size, int, S_IRUGO);
+
+static struct scull_ring *scull_ring_devices;
+static dev_t scull_ring_devno; // Our first device number
+
+/*
+ * Free space in the ring of the current CPU. Only a hint when
+ * called with preemption enabled.
+ */
+
+static unsigned int scull_ring_room(struct scull_ring *ring) {
+    return kfifo_avail(&raw_cpu_ptr(ring->cpu)->fifo);
+}
+
+/*
+ * Is there anything left for the consumer?
+ */
+
+static bool scull_ring_pending(struct scull_ring *ring) {
+    int cpu;
+
+    if (READ_ONCE(ring->rec_left))
+        return true;
+    for_each_possible_cpu(cpu)
+        if (!kfifo_is_empty(&per_cpu_ptr(ring->cpu, cpu)->fifo))
+            return true;
+    return false;
+}
+
+/*
+ * Pick up the header of the next record, looking at the CPUs in round
+ * robin order from the one after the last record drained. Must be called
+ * with the consumer lock held and no partial record outstanding.
+ */
+
+static bool scull_ring_next(struct scull_ring *ring) {
+    struct scull_ring_cpu *rc;
+    int cpu = ring->cur, i;
+    u32 len;
+
+    for (i = 0; i < num_possible_cpus(); i++) {
+        cpu = cpumask_next(cpu, cpu_possible_mask);
+        if (cpu >= nr_cpu_ids)
+            cpu = cpumask_first(cpu_possible_mask);
+        rc = per_cpu_ptr(ring->cpu, cpu);
+        // records are published whole, so a header means a full record
+        if (kfifo_out(&rc->fifo, &len, sizeof(len)) == sizeof(len)) {
+            ring->cur = cpu;
+            ring->rec_left = len;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Open and close
+ */
+
+static int scull_ring_open(struct inode *inode, struct file *filp) {
+    struct scull_ring *ring;
+
+    ring = container_of(inode->i_cdev, struct scull_ring, cdev);
+    filp->private_data = ring;
+    return nonseekable_open(inode, filp);
+}
+
+static int scull_ring_release(struct inode *inode, struct file *filp) {
+    return 0;
+}
+
+/*
+ * Data management: read and write
+ */
+
+static ssize_t scull_ring_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_ring *ring = filp->private_data;
+    struct scull_ring_cpu *rc;
+    unsigned int copied;
+    ssize_t done = 0;
+    int err;
+
+    if (mutex_lock_interruptible(&ring->lock))
+        return -ERESTARTSYS;
+
+    while (!scull_ring_pending(ring)) { // nothing to read
+        mutex_unlock(&ring->lock);
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(ring->inq, scull_ring_pending(ring)))
+            return -ERESTARTSYS; // signal: tell the fs layer to handle it
+        if (mutex_lock_interruptible(&ring->lock))
+            return -ERESTARTSYS;
+    }
+
+    // drain a batch, switching CPU only on record boundaries
+    while (done < count) {
+        if (!ring->rec_left && !scull_ring_next(ring))
+            break;
+        rc = per_cpu_ptr(ring->cpu, ring->cur);
+        err = kfifo_to_user(&rc->fifo, buf + done,
+                            min_t(size_t, count - done, ring->rec_left), &copied);
+        done += copied;
+        ring->rec_left -= copied;
+        if (err) {
+            if (!done)
+                done = err;
+            break;
+        }
+    }
+    mutex_unlock(&ring->lock);
+
+    // finally, awake any writers waiting for room
+    if (wq_has_sleeper(&ring->outq))
+        wake_up_interruptible(&ring->outq);
+    return done;
+}
+
+static ssize_t scull_ring_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_ring *ring = filp->private_data;
+    struct scull_ring_cpu *rc;
+    char stackbuf[SCULL_RING_STACKBUF];
+    char *rec = stackbuf;
+    unsigned int need;
+    ssize_t retval;
+    u32 len;
+
+    // the largest record a ring can ever hold
+    if (count > scull_ring_size - sizeof(len))
+        count = scull_ring_size - sizeof(len);
+    if (!count)
+        return 0;
+    len = count;
+    need = sizeof(len) + len;
+
+    // stage the record outside the ring: copy_from_user may sleep
+    if (need > sizeof(stackbuf)) {
+        rec = kmalloc(need, GFP_KERNEL);
+        if (!rec)
+            return -ENOMEM;
+    }
+    memcpy(rec, &len, sizeof(len));
+    if (copy_from_user(rec + sizeof(len), buf, len)) {
+        retval = -EFAULT;
+        goto out;
+    }
+
+    for (;;) {
+        rc = get_cpu_ptr(ring->cpu);
+        if (kfifo_avail(&rc->fifo) >= need) {
+            kfifo_in(&rc->fifo, rec, need);
+            put_cpu_ptr(ring->cpu);
+            break;
+        }
+        put_cpu_ptr(ring->cpu);
+
+        // full: we may come back on another CPU, so check again from scratch
+        if (filp->f_flags & O_NONBLOCK) {
+            retval = -EAGAIN;
+            goto out;
+        }
+        if (wait_event_interruptible(ring->outq, scull_ring_room(ring) >= need)) {
+            retval = -ERESTARTSYS;
+            goto out;
+        }
+    }
+
+    // only touch the shared wait queue if a reader is sleeping on it
+    if (wq_has_sleeper(&ring->inq))
+        wake_up_interruptible(&ring->inq);
+    retval = len;
+
+out:
+    if (rec != stackbuf)
+        kfree(rec);
+    return retval;
+}
+
+static __poll_t scull_ring_poll(struct file *filp, poll_table *wait) {
+    struct scull_ring *ring = filp->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(filp, &ring->inq, wait);
+    poll_wait(filp, &ring->outq, wait);
+    if (scull_ring_pending(ring))
+        mask |= EPOLLIN | EPOLLRDNORM; // readable
+    if (scull_ring_room(ring) > sizeof(u32))
+        mask |= EPOLLOUT | EPOLLWRNORM; // writable
+    return mask;
+}
+
+/*
+ * The file operations for the ring device
+ */
+
+static struct file_operations scull_ring_fops = {
+        .owner = THIS_MODULE,
+        .read = scull_ring_read,
+        .write = scull_ring_write,
+        .poll = scull_ring_poll,
+        .open = scull_ring_open,
+        .release = scull_ring_release,
+};
+
+
+#ifdef SCULL_DEBUG
+
+/*
+ * Show the fill level of every per-CPU ring
+ */
+
+static int scull_ring_proc_show(struct seq_file *s, void *v) {
+    struct scull_ring *ring;
+    int i, cpu;
+
+    seq_printf(s, "Default ring size is %i\n", scull_ring_size);
+    for (i = 0; i < scull_ring_nr_devs; i++) {
+        ring = scull_ring_devices + i;
+        if (mutex_lock_interruptible(&ring->lock))
+            return -ERESTARTSYS;
+        seq_printf(s, "\nDevice %i: cur %i, rec_left %u\n", i, ring->cur, ring->rec_left);
+        for_each_possible_cpu(cpu)
+            seq_printf(s, "  cpu %4i: %8u bytes queued\n",
+                       cpu, kfifo_len(&per_cpu_ptr(ring->cpu, cpu)->fifo));
+        mutex_unlock(&ring->lock);
+    }
+    return 0;
+}
+
+static int scull_ring_proc_open(struct inode *inode, struct file *file) {
+    return single_open(file, scull_ring_proc_show, NULL);
+}
+
+static struct file_operations scull_ring_proc_ops = {
+        .owner = THIS_MODULE,
+        .open = scull_ring_proc_open,
+        .read = seq_read,
+        .llseek = seq_lseek,
+        .release = single_release,
+};
+
+#endif // SCULL_DEBUG
+
+/*
+ * Set up a cdev entry.
+ */
+
+static void scull_ring_setup_cdev(struct scull_ring *ring, int index) {
+    int err, devno = scull_ring_devno + index;
+
+    cdev_init(&ring->cdev, &scull_ring_fops);
+    ring->cdev.owner = THIS_MODULE;
+    err = cdev_add(&ring->cdev, devno, 1);
+    if (err)
+        printk(KERN_NOTICE "Error %d adding scullring%d", err, index);
+}
+
+/*
+ * Allocate the per-CPU rings of a device, each one on the
+ * memory node of its CPU.
+ */
+
+static int scull_ring_alloc(struct scull_ring *ring) {
+    struct scull_ring_cpu *rc;
+    int cpu;
+
+    ring->cpu = alloc_percpu(struct scull_ring_cpu);
+    if (!ring->cpu)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu) {
+        rc = per_cpu_ptr(ring->cpu, cpu);
+        rc->buffer = kmalloc_node(scull_ring_size, GFP_KERNEL, cpu_to_node(cpu));
+        if (!rc->buffer)
+            return -ENOMEM;
+        kfifo_init(&rc->fifo, rc->buffer, scull_ring_size);
+    }
+    return 0;
+}
+
+static void scull_ring_free(struct scull_ring *ring) {
+    int cpu;
+
+    if (!ring->cpu)
+        return;
+    for_each_possible_cpu(cpu)
+        kfree(per_cpu_ptr(ring->cpu, cpu)->buffer);
+    free_percpu(ring->cpu);
+    ring->cpu = NULL;
+}
+
+/*
+ * Initialize the ring devs; return how many we did.
+ */
+
+int scull_ring_init(dev_t firstdev) {
+    int i, result;
+
+    result = register_chrdev_region(firstdev, scull_ring_nr_devs, "scullring");
+    if (result < 0) {
+        printk(KERN_NOTICE "Unable to get scullring region, error %d\n", result);
+        return 0;
+    }
+    scull_ring_devno = firstdev;
+
+    // kfifo wants a power of two
+    scull_ring_size = roundup_pow_of_two(max(scull_ring_size, SCULL_RING_STACKBUF));
+
+    scull_ring_devices = kcalloc(scull_ring_nr_devs, sizeof(struct scull_ring), GFP_KERNEL);
+    if (scull_ring_devices == NULL)
+        goto fail;
+    for (i = 0; i < scull_ring_nr_devs; i++)
+        if (scull_ring_alloc(scull_ring_devices + i))
+            goto fail;
+    for (i = 0; i < scull_ring_nr_devs; i++) {
+        init_waitqueue_head(&scull_ring_devices[i].inq);
+        init_waitqueue_head(&scull_ring_devices[i].outq);
+        mutex_init(&scull_ring_devices[i].lock);
+        scull_ring_devices[i].cur = -1;
+        scull_ring_setup_cdev(scull_ring_devices + i, i);
+    }
+
+#ifdef SCULL_DEBUG
+    proc_create("scullring", 0, NULL, proc_ops_wrapper(&scull_ring_proc_ops, scull_ring_pops));
+#endif // SCULL_DEBUG
+
+    return scull_ring_nr_devs;
+
+fail:
+    if (scull_ring_devices) {
+        for (i = 0; i < scull_ring_nr_devs; i++)
+            scull_ring_free(scull_ring_devices + i);
+        kfree(scull_ring_devices);
+        scull_ring_devices = NULL;
+    }
+    unregister_chrdev_region(firstdev, scull_ring_nr_devs);
+    return 0;
+}
+
+/*
+ * This is called by cleanup_module or on failure.
+ * It is required to never fail, even if nothing was initialized first
+ */
+
+void scull_ring_cleanup(void) {
+    int i;
+
+#ifdef SCULL_DEBUG
+    remove_proc_entry("scullring", NULL);
+#endif // SCULL_DEBUG
+
+    if (!scull_ring_devices)
+        return; // nothing else to release
+
+    for (i = 0; i < scull_ring_nr_devs; i++) {
+        cdev_del(&scull_ring_devices[i].cdev);
+        scull_ring_free(scull_ring_devices + i);
+    }
+    kfree(scull_ring_devices);
+    unregister_chrdev_region(scull_ring_devno, scull_ring_nr_devs);
+    scull_ring_devices = NULL; // pedantic
+}
@@ -1,6 +1,8 @@
 #ifndef _SCULL_H_
 #define _SCULL_H_
 
+#include "scull_ioctl.h"
+
 #ifndef SCULL_MAJOR
 #define SCULL_MAJOR 0 /* dynamic major by default */
 #endif
@@ -17,6 +19,100 @@
 #define SCULL_QSET 1000
 #endif
 
+/*
+ * Quantum layouts, for the scull_aligned module parameter
+ */
+#define SCULL_ALIGN_NONE 0  /* quantum used as given, LDD3 style */
+#define SCULL_ALIGN_CACHE 1 /* rounded up to whole cache lines */
+#define SCULL_ALIGN_PAGE 2  /* rounded up to whole pages */
+
+/*
+ * Devices that can be made at run time, through configfs
+ */
+#ifndef SCULL_MAX_DEVS
+#define SCULL_MAX_DEVS 64
+#endif
+
+/*
+ * How many devices the scull_node module parameter can place
+ */
+#ifndef SCULL_NR_NODE_PARAMS
+#define SCULL_NR_NODE_PARAMS 32
+#endif
+
+/*
+ * Limits of SCULL_IOCBATCH: entries per request, and how many
+ * descriptors are copied in from user space at a time.
+ */
+#ifndef SCULL_BATCH_MAX
+#define SCULL_BATCH_MAX 65536
+#endif
+
+#define SCULL_BATCH_CHUNK 64
+
+/*
+ * Locks striping the qsets of a device, by item number
+ */
+#ifndef SCULL_STRIPES
+#define SCULL_STRIPES 16
+#endif
+
+/*
+ * Change records each device keeps for SCULL_IOCCHANGES
+ */
+#ifndef SCULL_WATCH_RECORDS
+#define SCULL_WATCH_RECORDS 128
+#endif
+
+/*
+ * Bytes of a quantum covered by one checksum
+ */
+#ifndef SCULL_CRC_BLOCK
+#define SCULL_CRC_BLOCK 512
+#endif
+
+/*
+ * User pages pinned at a time by the direct transfer path, and the
+ * smallest read or write sent down it (0: never)
+ */
+#ifndef SCULL_DIRECT_PAGES
+#define SCULL_DIRECT_PAGES 64
+#endif
+
+#ifndef SCULL_DIRECT_MIN
+#define SCULL_DIRECT_MIN (1 << 20)
+#endif
+
+/*
+ * Throttling: users with a budget of their own on a device (the others
+ * share the device's), and the longest burst that may be configured
+ */
+#ifndef SCULL_QOS_UIDS
+#define SCULL_QOS_UIDS 256
+#endif
+
+#define SCULL_QOS_BURST_MAX 60000 /* ms */
+
+#ifndef SCULL_RING_NR_DEVS
+#define SCULL_RING_NR_DEVS 4 /* scullring0 through scullring3 */
+#endif
+
+/*
+ * Size of each per-CPU ring of a scullring device, in bytes.
+ * Rounded up to a power of two at load time.
+ */
+#ifndef SCULL_RING_SIZE
+#define SCULL_RING_SIZE (64 * 1024)
+#endif
+
+/*
+ * Records up to this size (header included) are staged on the
+ * stack instead of being kmalloc'd.
+ */
+#ifndef SCULL_RING_STACKBUF
+#define SCULL_RING_STACKBUF 256
+#endif
+
 #define SCULL_DEBUG
 
 #define proc_ops_wrapper(fops, newname)                             \
@@ -36,21 +132,177 @@
     })
 
 
+/*
+ * Checksum of one SCULL_CRC_BLOCK of a quantum: CRC32C of its first len bytes
+ */
+struct scull_sum {
+    u32 crc;
+    u16 len;
+    bool verified; // read back and found good since the last change
+    bool stale;    // changed since crc was computed
+};
+
 /*
  * Representation of scull quantum sets.
  */
 struct scull_qset {
     void **data;
-    struct scull_qset *next;
+    struct scull_sum *sum;  // per block of each quantum, when checksumming, or NULL
+    unsigned long *discard; // quanta the shrinker may drop, or NULL
+    long item;              // position of this set in the device
+    struct list_head list;  // in dev->qsets, sorted by item
+};
+
+/*
+ * A lock of its own cache line, so that writers on different stripes
+ * do not bounce one between them.
+ */
+struct scull_stripe {
+    struct mutex lock;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The changes made to a device, for mirrors that want to sync only
+ * what changed. Kept only while some file is watching.
+ */
+struct scull_watch {
+    spinlock_t lock;
+    atomic_t watchers;       // files that asked for changes
+    u64 seq;                 // of the newest change
+    u64 lost;                // newest seq overwritten so far
+    unsigned long head;      // records ever appended
+    struct scull_change rec[SCULL_WATCH_RECORDS]; // the last ones, a ring
+    struct list_head files;  // watching files with an eventfd
+    wait_queue_head_t wait;  // pollers
 };
 
 struct scull_dev {
-    struct scull_qset *data; // Pointer to first quantum set
+    struct list_head qsets;  // quantum sets, holes left out
     int quantum;             // the current quantum size
     int qset;                // the current array size
-    unsigned long size;      // amount of data stored here
-    struct mutex lock;       // mutual exclusion semaphore
-    struct cdev cdev;        // Char device structure
+    int crc;                 // quanta are checksummed
+    int cfg_quantum;         // geometry for the next trim, 0: the module's
+    int cfg_qset;
+    long limit;              // bytes of quanta the device may hold, 0: no limit
+    atomic_long_t mem;       // bytes of quanta it holds
+    atomic_long_t size;      // amount of data stored here
+    int node;                // NUMA node quanta are allocated on
+    int index;               // position in scull_devices
+    unsigned long gen;       // bumped whenever qsets are freed
+    unsigned long epoch;     // bumped whenever data is dropped
+    atomic_long_t nr_discardable; // quanta marked for the shrinker
+    struct scull_stats __percpu *stats; // operation and allocation counters
+    struct rw_semaphore sem; // read for I/O, write to free anything
+    struct mutex list_lock;  // serialises insertions into qsets
+    struct scull_stripe stripe[SCULL_STRIPES]; // qset contents, by item
+    struct scull_watch watch; // change records
+    struct scull_kv *kv;     // key-value index, see kv.c
+    struct scull_throttle *throttle; // rates and budgets, see qos.c
+    struct kref ref;         // held by scull_devices and by open files
+    struct cdev *cdev;       // char device, outlives us while files hold it
 };
 
+/*
+ * Per-open state: a cursor on the qset list, so that a file moving
+ * forward resumes from where it was instead of walking from the head.
+ * The cursor is only trusted while gen matches the device's.
+ */
+struct scull_file {
+    struct scull_dev *dev;   // the device this file was opened on
+    spinlock_t lock;         // guards the cursor
+    struct scull_qset *dptr; // last qset resolved
+    long item;               // its item number
+    unsigned long gen;       // dev->gen when dptr was resolved
+    loff_t next_pos;         // where a sequential read continues
+    int prio;                // SCULL_PRIO_* under throttling
+    bool watching;           // counted in dev->watch.watchers
+    u64 seen;                // newest change reported to this file
+    struct eventfd_ctx *efd; // signalled on changes, or NULL
+    struct list_head watch;  // in dev->watch.files while efd is set
+};
+
+/*
+ * One producer ring per CPU. Writers only ever touch the ring of the
+ * CPU they run on, so producers on different CPUs share no cache line.
+ */
+struct scull_ring_cpu {
+    struct kfifo fifo; // length-prefixed records
+    void *buffer;      // backing store of the fifo
+} ____cacheline_aligned_in_smp;
+
+struct scull_ring {
+    struct scull_ring_cpu __percpu *cpu; // per-CPU producer rings
+    struct mutex lock;                   // serialises the consumer side
+    int cur;                             // CPU of the record being drained
+    u32 rec_left;                        // bytes left in that record
+    wait_queue_head_t inq, outq;         // read and write queues
+    struct cdev cdev;                    // Char device structure
+};
+
+/*
+ * Prototypes for shared functions
+ */
+
+extern int scull_quantum;
+extern int scull_qset;
+extern int scull_aligned;
+extern int scull_crc;
+
+int scull_trim(struct scull_dev *dev);
+int scull_layout_quantum(int quantum);
+int scull_check_geometry(long quantum, long qset);
+void scull_get_stats(struct scull_dev *dev, struct scull_stats *stats);
+unsigned long scull_scrub(struct scull_dev *dev);
+int scull_mark_discardable(struct scull_dev *dev, loff_t start, loff_t len);
+unsigned long scull_reclaim(struct scull_dev *dev, unsigned long nr);
+int scull_punch(struct scull_dev *dev, loff_t start, loff_t len);
+int scull_truncate(struct scull_dev *dev, loff_t size);
+struct scull_qset *scull_follow(struct scull_dev *dev, long n, int alloc);
+struct scull_qset *scull_follow_cached(struct scull_file *sf, long n, int alloc);
+ssize_t scull_do_read(struct scull_file *sf, char __user *buf, size_t count, loff_t *f_pos);
+ssize_t scull_do_write(struct scull_file *sf, const char __user *buf, size_t count, loff_t *f_pos);
+ssize_t scull_direct_read(struct scull_file *sf, char __user *buf, size_t count, loff_t *f_pos);
+ssize_t scull_direct_write(struct scull_file *sf, const char __user *buf, size_t count, loff_t *f_pos);
+long scull_export(struct scull_file *sf, char __user *buf, size_t len, u64 *pos);
+int scull_import_start(struct scull_dev *dev, const struct scull_stream_hdr *hdr);
+long scull_import(struct scull_file *sf, const char __user *buf, size_t len, u64 *pos,
+                  struct scull_range *changed);
+
+struct scull_dev *scull_dev_create(void);
+void scull_dev_remove(struct scull_dev *dev);
+void scull_dev_put(struct scull_dev *dev);
+int scull_set_node(struct scull_dev *dev, int node);
+
+#if IS_ENABLED(CONFIG_CONFIGFS_FS)
+int scull_config_init(void);
+void scull_config_exit(void);
+#else
+static inline int scull_config_init(void) { return -ENOSYS; }
+static inline void scull_config_exit(void) {}
+#endif
+
+int scull_kv_init(struct scull_dev *dev);
+void scull_kv_free(struct scull_dev *dev);
+unsigned int scull_kv_count(struct scull_dev *dev);
+long scull_kv_get(struct scull_file *sf, struct scull_kv_op __user *uop);
+long scull_kv_put(struct scull_file *sf, struct scull_kv_op __user *uop);
+long scull_kv_del(struct scull_file *sf, struct scull_kv_op __user *uop);
+
+int scull_qos_init(struct scull_dev *dev);
+void scull_qos_free(struct scull_dev *dev);
+int scull_qos_admit(struct scull_file *sf, long ops, size_t bytes, unsigned long *gen);
+void scull_qos_done(struct scull_file *sf, unsigned long gen, size_t charged, long moved);
+int scull_qos_set(struct scull_dev *dev, const struct scull_qos *conf);
+void scull_qos_get(struct scull_dev *dev, struct scull_qos *conf);
+
+void scull_watch_init(struct scull_watch *watch);
+void scull_watch_release(struct scull_file *sf);
+void scull_notify(struct scull_dev *dev, loff_t start, loff_t len);
+int scull_watch_eventfd(struct scull_file *sf, int fd);
+long scull_watch_changes(struct scull_file *sf, struct scull_changes __user *uarg);
+__poll_t scull_watch_poll(struct file *filp, poll_table *wait);
+
+int scull_ring_init(dev_t dev);
+void scull_ring_cleanup(void);
+
 #endif // _SCULL_H_
@@ -0,0 +1,363 @@
+/*
+ * scull_bench: drive a scull device from user space and report
+ * throughput, latency percentiles and allocations per operation.
+ *
+ * Build with "make bench"; see scull_bench.sh for an unattended run.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "scull_ioctl.h"
+
+enum pattern { SEQ, RAND };
+
+struct config {
+    const char *path; // device to drive
+    int threads;
+    size_t io_size;
+    long ops;        // per thread
+    long long span;  // bytes of the device touched
+    enum pattern pattern;
+    int read_pct;    // share of reads, the rest are writes
+    int batch;       // >1: use SCULL_IOCBATCH with this many entries per call
+    int quantum, qset;
+    int csv;
+};
+
+struct worker {
+    pthread_t tid;
+    int id;
+    const struct config *cfg;
+    uint64_t *lat;   // one sample per syscall, in ns
+    long samples;
+    long done;       // operations carried out
+    long long bytes;
+    long errors;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/*
+ * Offset of the i-th operation of a worker: sequential workers stream
+ * through their own slice of the span, random ones hit it anywhere.
+ */
+static long long next_offset(const struct config *cfg, int id, long i, uint64_t *seed) {
+    long long slots = cfg->span / cfg->io_size;
+    long long slice = slots / cfg->threads;
+
+    if (slice == 0)
+        slice = 1;
+    if (cfg->pattern == RAND)
+        return (long long) (xorshift(seed) % slots) * cfg->io_size;
+    return ((id * slice + i % slice) % slots) * cfg->io_size;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    const struct config *cfg = w->cfg;
+    struct scull_batch_op *ops = NULL;
+    struct scull_batch batch;
+    uint64_t seed = 0x9e3779b97f4a7c15ull * (w->id + 1);
+    uint64_t t0;
+    char *buf;
+    long i, j, n, m;
+    ssize_t ret;
+    int fd, is_read;
+
+    fd = open(cfg->path, O_RDWR);
+    if (fd < 0) {
+        perror(cfg->path);
+        w->errors++;
+        return NULL;
+    }
+    n = cfg->batch > 1 ? cfg->batch : 1;
+    buf = malloc(cfg->io_size * n);
+    if (cfg->batch > 1)
+        ops = calloc(n, sizeof(*ops));
+    if (!buf || (cfg->batch > 1 && !ops)) {
+        perror("malloc");
+        w->errors++;
+        goto out;
+    }
+    memset(buf, 'a' + w->id % 26, cfg->io_size * n);
+
+    for (i = 0; i < cfg->ops; i += n) {
+        m = cfg->ops - i < n ? cfg->ops - i : n;
+        w->done += m;
+        if (cfg->batch > 1) {
+            for (j = 0; j < m; j++) {
+                ops[j].offset = next_offset(cfg, w->id, i + j, &seed);
+                ops[j].buf = (uintptr_t) (buf + j * cfg->io_size);
+                ops[j].len = cfg->io_size;
+                ops[j].flags = (int) (xorshift(&seed) % 100) < cfg->read_pct ? 0 : SCULL_BATCH_WRITE;
+            }
+            batch.ops = (uintptr_t) ops;
+            batch.nr = m;
+            t0 = now_ns();
+            ret = ioctl(fd, SCULL_IOCBATCH, &batch);
+            w->lat[w->samples++] = now_ns() - t0;
+            if (ret < 0) {
+                w->errors++;
+                continue;
+            }
+            for (j = 0; j < m; j++) {
+                if (ops[j].result < 0)
+                    w->errors++;
+                else
+                    w->bytes += ops[j].result;
+            }
+            continue;
+        }
+        is_read = (int) (xorshift(&seed) % 100) < cfg->read_pct;
+        t0 = now_ns();
+        if (is_read)
+            ret = pread(fd, buf, cfg->io_size, next_offset(cfg, w->id, i, &seed));
+        else
+            ret = pwrite(fd, buf, cfg->io_size, next_offset(cfg, w->id, i, &seed));
+        w->lat[w->samples++] = now_ns() - t0;
+        if (ret < 0)
+            w->errors++;
+        else
+            w->bytes += ret;
+    }
+out:
+    free(ops);
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const uint64_t *v, long n, double p) {
+    long idx = (long) (p * n + 0.999999) - 1;
+
+    if (n == 0)
+        return 0;
+    if (idx < 0)
+        idx = 0;
+    if (idx >= n)
+        idx = n - 1;
+    return v[idx] / 1000.0; // in us
+}
+
+/*
+ * Apply the requested geometry: it is module-wide and taken by a device
+ * on its next trim, which a write-only open triggers.
+ */
+static int set_geometry(const struct config *cfg) {
+    int fd;
+
+    if (!cfg->quantum && !cfg->qset)
+        return 0;
+    fd = open(cfg->path, O_RDWR);
+    if (fd < 0)
+        return -1;
+    if ((cfg->quantum && ioctl(fd, SCULL_IOCSQUANTUM, &cfg->quantum) < 0) ||
+        (cfg->qset && ioctl(fd, SCULL_IOCSQSET, &cfg->qset) < 0)) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    fd = open(cfg->path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+    close(fd);
+    return 0;
+}
+
+/*
+ * Fill the span so that reads find data rather than holes
+ */
+static int prefill(const struct config *cfg) {
+    char *buf = malloc(cfg->io_size);
+    long long off;
+    int fd, ret = 0;
+
+    fd = open(cfg->path, O_RDWR);
+    if (fd < 0 || !buf) {
+        free(buf);
+        return -1;
+    }
+    memset(buf, 'p', cfg->io_size);
+    for (off = 0; off + (long long) cfg->io_size <= cfg->span; off += cfg->io_size)
+        if (pwrite(fd, buf, cfg->io_size, off) != (ssize_t) cfg->io_size) {
+            ret = -1;
+            break;
+        }
+    close(fd);
+    free(buf);
+    return ret;
+}
+
+static int get_stats(const char *path, struct scull_stats *st) {
+    int fd = open(path, O_RDONLY), ret;
+
+    if (fd < 0)
+        return -1;
+    ret = ioctl(fd, SCULL_IOCGSTATS, st);
+    close(fd);
+    return ret;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-f dev] [-t threads] [-s io_size] [-n ops] [-S span]\n"
+            "          [-p seq|rand] [-r read_pct] [-b batch] [-q quantum] [-Q qset] [-c]\n"
+            "  -f  device to drive (/dev/scull0)\n"
+            "  -t  worker threads, one open file each (1)\n"
+            "  -s  bytes per operation (4000)\n"
+            "  -n  operations per thread (100000)\n"
+            "  -S  bytes of the device touched (16M)\n"
+            "  -p  access pattern: seq or rand (seq)\n"
+            "  -r  percentage of reads, the rest are writes (50)\n"
+            "  -b  entries per SCULL_IOCBATCH call, 1 means plain pread/pwrite (1)\n"
+            "  -q  quantum, -Q qset: set before the run, trimming the device\n"
+            "  -c  print one CSV line instead of a report\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    struct config cfg = {
+            .path = "/dev/scull0",
+            .threads = 1,
+            .io_size = 4000,
+            .ops = 100000,
+            .span = 16 << 20,
+            .pattern = SEQ,
+            .read_pct = 50,
+            .batch = 1,
+    };
+    struct scull_stats before, after;
+    struct worker *w;
+    uint64_t *all, t0, elapsed;
+    long long bytes = 0;
+    long total = 0, done = 0, errors = 0, k;
+    double secs, allocs_per_op = -1;
+    int opt, i, have_stats;
+
+    while ((opt = getopt(argc, argv, "f:t:s:n:S:p:r:b:q:Q:ch")) != -1) {
+        switch (opt) {
+        case 'f': cfg.path = optarg; break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 's': cfg.io_size = strtoul(optarg, NULL, 0); break;
+        case 'n': cfg.ops = atol(optarg); break;
+        case 'S': cfg.span = strtoll(optarg, NULL, 0); break;
+        case 'p': cfg.pattern = strcmp(optarg, "rand") ? SEQ : RAND; break;
+        case 'r': cfg.read_pct = atoi(optarg); break;
+        case 'b': cfg.batch = atoi(optarg); break;
+        case 'q': cfg.quantum = atoi(optarg); break;
+        case 'Q': cfg.qset = atoi(optarg); break;
+        case 'c': cfg.csv = 1; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (cfg.threads < 1 || cfg.io_size < 1 || cfg.ops < 1 || cfg.batch < 1 ||
+        cfg.span < (long long) cfg.io_size || cfg.read_pct < 0 || cfg.read_pct > 100) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (set_geometry(&cfg)) {
+        perror("setting quantum/qset");
+        return 1;
+    }
+    if (cfg.read_pct && prefill(&cfg)) {
+        perror("prefill");
+        return 1;
+    }
+
+    w = calloc(cfg.threads, sizeof(*w));
+    if (!w)
+        return 1;
+    for (i = 0; i < cfg.threads; i++) {
+        w[i].id = i;
+        w[i].cfg = &cfg;
+        w[i].lat = malloc(sizeof(uint64_t) * (cfg.ops / cfg.batch + 1));
+        if (!w[i].lat)
+            return 1;
+    }
+
+    have_stats = get_stats(cfg.path, &before) == 0;
+    t0 = now_ns();
+    for (i = 0; i < cfg.threads; i++)
+        pthread_create(&w[i].tid, NULL, worker_main, &w[i]);
+    for (i = 0; i < cfg.threads; i++)
+        pthread_join(w[i].tid, NULL);
+    elapsed = now_ns() - t0;
+    have_stats = have_stats && get_stats(cfg.path, &after) == 0;
+
+    for (i = 0; i < cfg.threads; i++) {
+        total += w[i].samples;
+        done += w[i].done;
+        bytes += w[i].bytes;
+        errors += w[i].errors;
+    }
+    all = malloc(sizeof(uint64_t) * (total + 1));
+    if (!all)
+        return 1;
+    for (i = 0, k = 0; i < cfg.threads; i++) {
+        memcpy(all + k, w[i].lat, sizeof(uint64_t) * w[i].samples);
+        k += w[i].samples;
+    }
+    qsort(all, total, sizeof(uint64_t), cmp_u64);
+
+    secs = elapsed / 1e9;
+    if (have_stats && done)
+        allocs_per_op = (double) (after.allocs - before.allocs) / done;
+
+    if (cfg.csv) {
+        // threads,io_size,pattern,read_pct,batch,ops,MB/s,kops/s,p50,p99,p999,allocs/op,errors
+        printf("%d,%zu,%s,%d,%d,%ld,%.1f,%.1f,%.2f,%.2f,%.2f,%.4f,%ld\n",
+               cfg.threads, cfg.io_size, cfg.pattern == RAND ? "rand" : "seq",
+               cfg.read_pct, cfg.batch, done, bytes / secs / 1e6,
+               done / secs / 1e3, percentile(all, total, 0.50),
+               percentile(all, total, 0.99), percentile(all, total, 0.999),
+               allocs_per_op, errors);
+    } else {
+        printf("%s: %d thread(s), %zu bytes/op, %s, %d%% reads, batch %d\n",
+               cfg.path, cfg.threads, cfg.io_size, cfg.pattern == RAND ? "random" : "sequential",
+               cfg.read_pct, cfg.batch);
+        printf("  ops        %ld in %.3f s (%ld errors)\n", done, secs, errors);
+        printf("  throughput %.1f MB/s, %.1f kops/s\n", bytes / secs / 1e6, done / secs / 1e3);
+        printf("  latency    p50 %.2f us, p99 %.2f us, p999 %.2f us (per syscall)\n",
+               percentile(all, total, 0.50), percentile(all, total, 0.99), percentile(all, total, 0.999));
+        if (allocs_per_op >= 0)
+            printf("  allocs/op  %.4f\n", allocs_per_op);
+        else
+            printf("  allocs/op  n/a (no SCULL_IOCGSTATS)\n");
+    }
+
+    for (i = 0; i < cfg.threads; i++)
+        free(w[i].lat);
+    free(w);
+    free(all);
+    return errors ? 1 : 0;
+}
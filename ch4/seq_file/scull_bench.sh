@@ -0,0 +1,61 @@
+#!/bin/sh
+# Unattended benchmark run, e.g. from the init script of a QEMU guest:
+# load the module, run a fixed matrix of scull_bench configurations,
+# unload, and optionally compare against a previous run.
+#
+#   ./scull_bench.sh [baseline.csv]
+#
+# Results go to stdout as CSV. With a baseline, the script fails when any
+# configuration loses more than $THRESHOLD percent of throughput.
+# Every configuration runs with both the packed (LDD3) and the page
+# aligned quantum layout, see the scull_aligned module parameter.
+device="/dev/scull0"
+layout="/sys/module/scull/parameters/scull_aligned"
+threshold=${THRESHOLD:-10}
+
+cd "$(dirname "$0")" || exit 1
+[ -x ./scull_bench ] || make bench || exit 1
+
+sh ./scull_load.sh || exit 1
+trap 'sh ./scull_unload.sh' EXIT
+
+# run one configuration, prefixing its CSV line with the layout
+run() {
+    line=$(./scull_bench -c -f $device "$@") || status=1
+    echo "$aligned,$line" >> "$out"
+}
+
+out=$(mktemp)
+echo "layout,threads,io_size,pattern,read_pct,batch,ops,MB/s,kops/s,p50_us,p99_us,p999_us,allocs_per_op,errors"
+for aligned in 0 2; do
+    echo $aligned > $layout || exit 1
+    : > $device # a write-only open trims, picking up the layout
+    for threads in 1 4; do
+        for size in 64 4000 4096 65536; do
+            for pattern in seq rand; do
+                for mix in 0 100; do
+                    run -t $threads -s $size -p $pattern -r $mix -n 20000
+                done
+            done
+        done
+        run -t $threads -s 64 -p rand -r 50 -b 64 -n 200000
+    done
+done
+echo 0 > $layout
+cat "$out"
+
+if [ -n "$1" ]; then
+    # key is everything up to the op count, MB/s is field 8
+    awk -F, -v t="$threshold" '
+        { key = $1","$2","$3","$4","$5","$6 }
+        NR == FNR { base[key] = $8; next }
+        key in base {
+            if (base[key] > 0 && $8 < base[key] * (100 - t) / 100) {
+                printf "REGRESSION %s: %.1f MB/s, was %.1f\n", key, $8, base[key]
+                bad = 1
+            }
+        }
+        END { exit bad }' "$1" "$out" || status=1
+fi
+rm -f "$out"
+exit ${status:-0}
@@ -0,0 +1,197 @@
+#ifndef _SCULL_IOCTL_H_
+#define _SCULL_IOCTL_H_
+
+/*
+ * Ioctl definitions, shared by the driver and by user-space tools.
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * One entry of a SCULL_IOCBATCH request: a pread() or pwrite() of len
+ * bytes at offset. result is filled in with the number of bytes moved,
+ * or a negative errno if nothing was.
+ */
+struct scull_batch_op {
+    __u64 offset; /* position in the device */
+    __u64 buf;    /* user buffer, cast to __u64 */
+    __u32 len;    /* bytes to move */
+    __u32 flags;  /* SCULL_BATCH_* */
+    __s64 result; /* out: bytes moved or -errno */
+};
+
+#define SCULL_BATCH_WRITE 0x1 /* pwrite() rather than pread() */
+
+struct scull_batch {
+    __u64 ops;  /* array of struct scull_batch_op, cast to __u64 */
+    __u32 nr;   /* number of entries in ops */
+    __u32 done; /* out: entries carried out */
+};
+
+/*
+ * Per-device counters, as returned by SCULL_IOCGSTATS
+ */
+struct scull_stats {
+    __u64 reads;  /* quantum-sized read steps */
+    __u64 writes; /* quantum-sized write steps */
+    __u64 allocs; /* qset nodes, qset arrays and quanta allocated */
+    __u64 frees;  /* and freed */
+    __u64 reclaimed; /* discardable quanta dropped by the shrinker */
+    __u64 checked;   /* checksummed blocks verified */
+    __u64 crc_errors; /* of which did not match */
+};
+
+/*
+ * A byte range of a device
+ */
+struct scull_range {
+    __u64 offset;
+    __u64 len;
+};
+
+/*
+ * A byte range of a device that changed, as reported by SCULL_IOCCHANGES.
+ * seq grows with every change; adjacent writes are merged into one
+ * record, which then gets a new seq.
+ */
+struct scull_change {
+    __u64 seq;
+    __u64 offset;
+    __u64 len;
+};
+
+/*
+ * Argument of SCULL_IOCCHANGES: room for nr records at buf. The ioctl
+ * returns how many were filled in, oldest first, and only ever reports
+ * changes this file has not been told about yet.
+ */
+struct scull_changes {
+    __u64 buf;   /* array of struct scull_change, cast to __u64 */
+    __u32 nr;    /* entries at buf */
+    __u32 flags; /* out: SCULL_CHANGES_* */
+    __u64 size;  /* out: size of the device */
+};
+
+#define SCULL_CHANGES_LOST 0x1 /* records were overwritten unread: resync everything */
+
+/*
+ * Export and import stream. It starts with a header describing the
+ * layout, followed by one record per allocated quantum below the size,
+ * each followed by len bytes of data; holes take no room at all. The
+ * stream is in the byte order of the exporting host, and an importer
+ * with another one sees a wrong magic.
+ */
+#define SCULL_STREAM_MAGIC 0x6c756373 /* "scul" */
+#define SCULL_STREAM_VERSION 1
+
+struct scull_stream_hdr {
+    __u32 magic;   /* SCULL_STREAM_MAGIC */
+    __u32 version; /* SCULL_STREAM_VERSION */
+    __u32 quantum;
+    __u32 qset;
+    __u64 size;
+};
+
+struct scull_stream_rec {
+    __u64 quantum; /* index of the quantum in the device */
+    __u32 len;     /* bytes of data that follow */
+    __u32 pad;
+};
+
+/*
+ * Argument of SCULL_IOCEXPORT and SCULL_IOCIMPORT: one chunk of the
+ * stream at buf. Start with pos at 0 and hand back what the driver left
+ * there. Export fills in whole records only and reports 0 bytes at the
+ * end of the stream; import consumes whole records only, and the rest
+ * is to be passed again, completed, on the next call.
+ */
+struct scull_stream {
+    __u64 buf;  /* user buffer, cast to __u64 */
+    __u64 len;  /* bytes at buf */
+    __u64 pos;  /* in/out: where the stream stands */
+    __u64 done; /* out: bytes produced (export) or consumed (import) */
+};
+
+/*
+ * Argument of the key-value ioctls. A key is up to SCULL_KV_KEY_MAX
+ * bytes of anything; its value is stored in the device's own quanta,
+ * after whatever the device held when the first key went in. A get
+ * with len 0 only reports the length of the value, one with too small
+ * a buffer fails with ERANGE.
+ */
+#define SCULL_KV_KEY_MAX 60
+
+struct scull_kv_op {
+    __u64 key;   /* key bytes, cast to __u64 */
+    __u64 val;   /* value buffer, cast to __u64 */
+    __u32 klen;  /* bytes of key */
+    __u32 len;   /* bytes at val; out (get): length of the value */
+    __u32 flags; /* SCULL_KV_* (put only) */
+    __u32 pad;
+};
+
+#define SCULL_KV_CREATE 0x1  /* put fails with EEXIST if the key is there */
+#define SCULL_KV_REPLACE 0x2 /* put fails with ENOENT if it is not */
+
+/*
+ * Throttling of a device, set with SCULL_IOCSQOS and read back, with
+ * its counters, with SCULL_IOCGQOS. Reads, writes, batches, key-value
+ * gets and puts, and export and import chunks wait until the device
+ * (or, with SCULL_QOS_PER_UID, the caller's user) is back within its
+ * rates; up to burst_ms worth of them may go through at once after an
+ * idle spell. A rate of 0 is no limit.
+ */
+struct scull_qos {
+    __u64 bps;      /* bytes per second */
+    __u64 iops;     /* operations per second */
+    __u32 burst_ms;
+    __u32 flags;    /* SCULL_QOS_* */
+    __u64 throttled; /* out: operations that had to wait */
+    __u64 wait_ns;   /* out: time they spent waiting */
+};
+
+#define SCULL_QOS_PER_UID 0x1 /* one budget per user rather than per device */
+
+/*
+ * Priority of a file's I/O under throttling (SCULL_IOCSPRIO): while a
+ * high-priority file waits for the budget, normal ones do not get any.
+ */
+#define SCULL_PRIO_NORMAL 0
+#define SCULL_PRIO_HIGH 1
+
+/* Use 'k' as magic number */
+#define SCULL_IOC_MAGIC 'k'
+
+/*
+ * S means "Set" through a ptr,
+ * G means "Get": reply by setting through a pointer
+ */
+#define SCULL_IOCSNODE _IOW(SCULL_IOC_MAGIC, 1, int) /* NUMA node for new quanta */
+#define SCULL_IOCGNODE _IOR(SCULL_IOC_MAGIC, 2, int)
+#define SCULL_IOCBATCH _IOWR(SCULL_IOC_MAGIC, 3, struct scull_batch)
+#define SCULL_IOCSQUANTUM _IOW(SCULL_IOC_MAGIC, 4, int) /* used from the next trim on */
+#define SCULL_IOCSQSET _IOW(SCULL_IOC_MAGIC, 5, int)
+#define SCULL_IOCGQUANTUM _IOR(SCULL_IOC_MAGIC, 6, int)
+#define SCULL_IOCGQSET _IOR(SCULL_IOC_MAGIC, 7, int)
+#define SCULL_IOCGSTATS _IOR(SCULL_IOC_MAGIC, 8, struct scull_stats)
+#define SCULL_IOCDISCARDABLE _IOW(SCULL_IOC_MAGIC, 9, struct scull_range) /* may be reclaimed */
+#define SCULL_IOCPUNCH _IOW(SCULL_IOC_MAGIC, 10, struct scull_range) /* free a range, keep the size */
+#define SCULL_IOCTRUNCATE _IOW(SCULL_IOC_MAGIC, 11, __u64) /* set the size, like ftruncate(2) */
+#define SCULL_IOCEVENTFD _IOW(SCULL_IOC_MAGIC, 12, int) /* signalled on change, -1 to stop */
+#define SCULL_IOCCHANGES _IOWR(SCULL_IOC_MAGIC, 13, struct scull_changes)
+#define SCULL_IOCSCRUB _IO(SCULL_IOC_MAGIC, 14) /* verify every checksum, returns mismatches */
+#define SCULL_IOCEXPORT _IOWR(SCULL_IOC_MAGIC, 15, struct scull_stream)
+#define SCULL_IOCIMPORT _IOWR(SCULL_IOC_MAGIC, 16, struct scull_stream) /* replaces the contents */
+
+#define SCULL_IOCKVGET _IOWR(SCULL_IOC_MAGIC, 17, struct scull_kv_op)
+#define SCULL_IOCKVPUT _IOW(SCULL_IOC_MAGIC, 18, struct scull_kv_op)
+#define SCULL_IOCKVDEL _IOW(SCULL_IOC_MAGIC, 19, struct scull_kv_op)
+
+#define SCULL_IOCSQOS _IOW(SCULL_IOC_MAGIC, 20, struct scull_qos) /* counters are ignored */
+#define SCULL_IOCGQOS _IOR(SCULL_IOC_MAGIC, 21, struct scull_qos)
+#define SCULL_IOCSPRIO _IOW(SCULL_IOC_MAGIC, 22, int) /* SCULL_PRIO_* of this file */
+
+#define SCULL_IOC_MAXNR 22
+
+#endif // _SCULL_IOCTL_H_
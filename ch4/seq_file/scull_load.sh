@@ -8,19 +8,27 @@ mode="664"
 /sbin/insmod ./$module.ko $* || exit 1
 
 # remove stale nodes
-rm -f /dev/${device}[0-3]
+rm -f /dev/${device}[0-3] /dev/${device}ring[0-3]
 
-major=$(awk "\$2==\"$module\" {print \$1}" /proc/devices)
+major=$(awk "\$2==\"$module\" {print \$1; exit}" /proc/devices)
 
 mknod /dev/${device}0 c $major 0
 mknod /dev/${device}1 c $major 1
 mknod /dev/${device}2 c $major 2
 mknod /dev/${device}3 c $major 3
 
+mknod /dev/${device}ring0 c $major 4
+mknod /dev/${device}ring1 c $major 5
+mknod /dev/${device}ring2 c $major 6
+mknod /dev/${device}ring3 c $major 7
+
+# Devices made later through /sys/kernel/config/scull get the minors
+# after these; their nodes are made from the "dev" file of each (see config.c).
+
 # give appropriate group/permissions, and change the group.
 # Not all distributions have staff, some have "wheel" instead.
 group="staff"
 grep -q '^staff:' /etc/group || group="wheel"
 
-chgrp $group /dev/${device}[0-3]
-chmod $mode /dev/${device}[0-3]
+chgrp $group /dev/${device}[0-3] /dev/${device}ring[0-3]
+chmod $mode /dev/${device}[0-3] /dev/${device}ring[0-3]
@@ -2,8 +2,13 @@
 module="scull"
 device="scull"
 
+# devices made at run time through configfs pin the module
+for d in /sys/kernel/config/scull/*/; do
+    [ -d "$d" ] && rmdir "$d"
+done
+
 # invoke rmmod with all arguments we got
 /sbin/rmmod $module $* || exit 1
 
 # Remove stale nodes
-rm -f /dev/${device}[0-3]
+rm -f /dev/${device}[0-3] /dev/${device}ring[0-3]
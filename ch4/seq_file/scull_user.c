@@ -0,0 +1,102 @@
+/*
+ * Glue for the user-space build of the storage engine: the module
+ * parameters storage.c refers to, and device setup as scull_init and
+ * scull_open would do it.
+ */
+
+#include "scull_user.h"
+
+#include "scull.h"
+
+int scull_quantum = SCULL_QUANTUM;
+int scull_qset = SCULL_QSET;
+int scull_aligned = SCULL_ALIGN_NONE;
+int scull_crc;
+
+unsigned long scull_user_fail_after;
+
+void scull_user_dev_init(struct scull_dev *dev, int quantum, int qset) {
+    int i;
+
+    memset(dev, 0, sizeof(*dev));
+    scull_quantum = quantum;
+    dev->quantum = scull_layout_quantum(quantum);
+    scull_qset = dev->qset = qset;
+    dev->crc = scull_crc;
+    dev->node = NUMA_NO_NODE;
+    dev->stats = alloc_percpu(struct scull_stats);
+    if (!dev->stats)
+        abort();
+    INIT_LIST_HEAD(&dev->qsets);
+    init_rwsem(&dev->sem);
+    mutex_init(&dev->list_lock);
+    for (i = 0; i < SCULL_STRIPES; i++)
+        mutex_init(&dev->stripe[i].lock);
+}
+
+void scull_user_dev_exit(struct scull_dev *dev) {
+    scull_trim(dev);
+    free_percpu(dev->stats);
+}
+
+void scull_user_file_init(struct scull_file *sf, struct scull_dev *dev) {
+    memset(sf, 0, sizeof(*sf));
+    sf->dev = dev;
+    spin_lock_init(&sf->lock);
+    sf->next_pos = -1;
+}
+
+/*
+ * CRC32C (Castagnoli), without pre- or post-inversion, like the kernel's
+ * crc32c(): bit-reflected, polynomial 0x82f63b78.
+ */
+
+static u32 crc32c_table[256];
+
+static u32 crc32c_sw(u32 crc, const unsigned char *p, unsigned int len) {
+    int i, j;
+
+    if (!crc32c_table[1])
+        for (i = 0; i < 256; i++) {
+            u32 c = i;
+
+            for (j = 0; j < 8; j++)
+                c = c & 1 ? c >> 1 ^ 0x82f63b78 : c >> 1;
+            crc32c_table[i] = c;
+        }
+    while (len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ crc >> 8;
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static u32 crc32c_hw(u32 crc, const unsigned char *p, unsigned int len) {
+    u64 c = crc, v;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&v, p, 8);
+        c = __builtin_ia32_crc32di(c, v);
+    }
+    crc = c;
+    while (len--)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+
+u32 crc32c(u32 crc, const void *p, unsigned int len) {
+    static int hw = -1;
+
+    if (hw < 0)
+        hw = __builtin_cpu_supports("sse4.2");
+    return hw ? crc32c_hw(crc, p, len) : crc32c_sw(crc, p, len);
+}
+
+#else
+
+u32 crc32c(u32 crc, const void *p, unsigned int len) {
+    return crc32c_sw(crc, p, len);
+}
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef _SCULL_USER_H_
+#define _SCULL_USER_H_
+
+/*
+ * Just enough of the kernel API for storage.c to build and run in user
+ * space. copy_{to,from}_user become memcpy, kmalloc_node becomes malloc
+ * (with optional failure injection) and locks become pthread mutexes.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <linux/types.h>
+
+#define __user
+#define __percpu
+#define ____cacheline_aligned_in_smp __attribute__((aligned(64)))
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+#define ERESTARTSYS 512
+
+#define pr_debug(...) do { } while (0)
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define KERN_INFO ""
+#define KERN_NOTICE ""
+#define pr_warn_ratelimited(...) do { } while (0)
+
+#define cond_resched() do { } while (0)
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) min((t) (a), (t) (b))
+#define max_t(t, a, b) max((t) (a), (t) (b))
+#define container_of(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+#define prefetch(p) __builtin_prefetch(p)
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+
+/*
+ * Atomics and per-CPU data: one copy, updated with compiler builtins
+ */
+
+typedef struct {
+    long counter;
+} atomic_long_t;
+
+static inline long atomic_long_read(const atomic_long_t *v) {
+    return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_long_set(atomic_long_t *v, long i) {
+    __atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_long_inc(atomic_long_t *v) {
+    __atomic_fetch_add(&v->counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_long_dec(atomic_long_t *v) {
+    __atomic_fetch_sub(&v->counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline long atomic_long_add_return(long i, atomic_long_t *v) {
+    return __atomic_add_fetch(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_long_sub(long i, atomic_long_t *v) {
+    __atomic_fetch_sub(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline bool atomic_long_try_cmpxchg(atomic_long_t *v, long *old, long new) {
+    return __atomic_compare_exchange_n(&v->counter, old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+#define alloc_percpu(type) ((type *) calloc(1, sizeof(type)))
+#define free_percpu(p) free(p)
+#define per_cpu_ptr(p, cpu) ((void) (cpu), (p))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_inc(x) __atomic_fetch_add(&(x), 1, __ATOMIC_RELAXED)
+
+/*
+ * Non-atomic bit operations; the engine only uses them under the device lock
+ */
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define BITS_TO_LONGS(nr) DIV_ROUND_UP(nr, BITS_PER_LONG)
+
+static inline int test_bit(long nr, const unsigned long *addr) {
+    return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline void __set_bit(long nr, unsigned long *addr) {
+    addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(long nr, unsigned long *addr) {
+    addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline unsigned long find_next_bit(const unsigned long *addr, unsigned long size, unsigned long off) {
+    for (; off < size; off++)
+        if (test_bit(off, addr))
+            return off;
+    return size;
+}
+
+#define for_each_set_bit(bit, addr, size)                 \
+    for ((bit) = find_next_bit((addr), (size), 0);        \
+         (bit) < (size);                                  \
+         (bit) = find_next_bit((addr), (size), (bit) + 1))
+
+/*
+ * Doubly linked lists, the parts of <linux/list.h> the engine uses
+ */
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+    list->next = list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev, struct list_head *next) {
+    next->prev = new;
+    new->next = next;
+    new->prev = prev;
+    prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head) {
+    __list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head) {
+    __list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    entry->next = entry->prev = NULL;
+}
+
+static inline int list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+
+static inline int list_is_last(const struct list_head *list, const struct list_head *head) {
+    return list->next == head;
+}
+
+/*
+ * Lists readers walk while one writer appends, as in <linux/rculist.h>
+ */
+
+#define list_next_rcu(list) ((list)->next)
+#define rcu_dereference_raw(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+static inline void list_add_tail_rcu(struct list_head *new, struct list_head *head) {
+    struct list_head *prev = head->prev;
+
+    new->next = head;
+    new->prev = prev;
+    __atomic_store_n(&prev->next, new, __ATOMIC_RELEASE);
+    head->prev = new;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+#define list_last_entry(ptr, type, member) list_entry((ptr)->prev, type, member)
+#define list_next_entry(pos, member) list_entry((pos)->member.next, __typeof__(*(pos)), member)
+#define list_prev_entry(pos, member) list_entry((pos)->member.prev, __typeof__(*(pos)), member)
+
+#define list_for_each_entry(pos, head, member)                       \
+    for (pos = list_first_entry(head, __typeof__(*pos), member);     \
+         &pos->member != (head);                                     \
+         pos = list_next_entry(pos, member))
+
+#define list_for_each_entry_safe(pos, n, head, member)               \
+    for (pos = list_first_entry(head, __typeof__(*pos), member),     \
+         n = list_next_entry(pos, member);                           \
+         &pos->member != (head);                                     \
+         pos = n, n = list_next_entry(n, member))
+
+#define list_for_each_entry_safe_reverse(pos, n, head, member)       \
+    for (pos = list_last_entry(head, __typeof__(*pos), member),      \
+         n = list_prev_entry(pos, member);                           \
+         &pos->member != (head);                                     \
+         pos = n, n = list_prev_entry(n, member))
+
+#define L1_CACHE_BYTES 64
+#define PAGE_SIZE 4096
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+/*
+ * Memory: when scull_user_fail_after is nonzero, the allocation that
+ * brings it down to zero fails, so ENOMEM paths can be exercised.
+ */
+
+#define GFP_KERNEL 0
+#define KMALLOC_MAX_SIZE (1UL << 22)
+#define NUMA_NO_NODE (-1)
+
+extern unsigned long scull_user_fail_after;
+
+static inline void *kmalloc_node(size_t size, int flags, int node) {
+    (void) flags;
+    (void) node;
+    if (scull_user_fail_after && !--scull_user_fail_after)
+        return NULL;
+    return malloc(size);
+}
+
+static inline void *kmalloc(size_t size, int flags) {
+    return kmalloc_node(size, flags, NUMA_NO_NODE);
+}
+
+static inline void kfree(const void *p) {
+    free((void *) p);
+}
+
+/*
+ * "User" buffers are plain memory here
+ */
+
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n) {
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n) {
+    memcpy(to, from, n);
+    return 0;
+}
+
+/*
+ * Pinning user pages: a "page" is just the address of the page in the
+ * buffer, which stays where it is anyway
+ */
+
+struct page;
+
+#define FOLL_WRITE 0x01
+
+static inline int pin_user_pages_fast(unsigned long start, int nr_pages, unsigned int gup_flags,
+                                      struct page **pages) {
+    int i;
+
+    (void) gup_flags;
+    for (i = 0; i < nr_pages; i++)
+        pages[i] = (struct page *) (start + i * PAGE_SIZE);
+    return nr_pages;
+}
+
+static inline void unpin_user_pages_dirty_lock(struct page **pages, unsigned long npages, bool make_dirty) {
+    (void) pages;
+    (void) npages;
+    (void) make_dirty;
+}
+
+#define kmap_local_page(page) ((char *) (page))
+#define kunmap_local(addr) do { (void) (addr); } while (0)
+
+/*
+ * Locking
+ */
+
+struct mutex {
+    pthread_mutex_t m;
+};
+
+static inline void mutex_init(struct mutex *l) {
+    pthread_mutex_init(&l->m, NULL);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *l) {
+    return pthread_mutex_lock(&l->m);
+}
+
+static inline void mutex_lock(struct mutex *l) {
+    pthread_mutex_lock(&l->m);
+}
+
+static inline void mutex_unlock(struct mutex *l) {
+    pthread_mutex_unlock(&l->m);
+}
+
+struct rw_semaphore {
+    pthread_rwlock_t rw;
+};
+
+static inline void init_rwsem(struct rw_semaphore *sem) {
+    pthread_rwlock_init(&sem->rw, NULL);
+}
+
+static inline int down_read_interruptible(struct rw_semaphore *sem) {
+    return pthread_rwlock_rdlock(&sem->rw);
+}
+
+static inline int down_write_killable(struct rw_semaphore *sem) {
+    return pthread_rwlock_wrlock(&sem->rw);
+}
+
+static inline int down_write_trylock(struct rw_semaphore *sem) {
+    return !pthread_rwlock_trywrlock(&sem->rw);
+}
+
+static inline void up_read(struct rw_semaphore *sem) {
+    pthread_rwlock_unlock(&sem->rw);
+}
+
+static inline void up_write(struct rw_semaphore *sem) {
+    pthread_rwlock_unlock(&sem->rw);
+}
+
+typedef struct mutex spinlock_t;
+
+#define spin_lock_init(l) mutex_init(l)
+#define spin_lock(l) mutex_lock(l)
+#define spin_unlock(l) mutex_unlock(l)
+
+/*
+ * Types scull.h mentions but the storage engine never uses
+ */
+
+struct cdev {
+    int unused;
+};
+
+struct kref {
+    int unused;
+};
+
+#define IS_ENABLED(option) 0
+
+struct kfifo {
+    int unused;
+};
+
+typedef struct {
+    int unused;
+} wait_queue_head_t;
+
+typedef struct {
+    int unused;
+} poll_table;
+
+struct file;
+
+typedef struct {
+    int counter;
+} atomic_t;
+
+/*
+ * CRC32C, from scull_user.c: SSE4.2 when the CPU has it
+ */
+
+u32 crc32c(u32 crc, const void *p, unsigned int len);
+
+/*
+ * Setup helpers, from scull_user.c
+ */
+
+struct scull_dev;
+struct scull_file;
+
+void scull_user_dev_init(struct scull_dev *dev, int quantum, int qset);
+void scull_user_dev_exit(struct scull_dev *dev);
+void scull_user_file_init(struct scull_file *sf, struct scull_dev *dev);
+
+#endif // _SCULL_USER_H_
@@ -0,0 +1,1151 @@
+/*
+ * The scull storage engine: the list of quantum sets and how byte
+ * offsets map onto it.
+ *
+ * This file knows nothing about the VFS, so it builds both into the
+ * module and, against scull_user.h, into a user-space library for
+ * benchmarking and fuzzing (see "make user").
+ */
+
+#ifdef __KERNEL__
+#include <linux/cdev.h>
+#include <linux/crc32c.h>
+#include <linux/kernel.h>
+#include <linux/kfifo.h>
+#include <linux/highmem.h> // kmap_local_page
+#include <linux/list.h>
+#include <linux/mm.h>      // pin_user_pages_fast
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/prefetch.h>
+#include <linux/rculist.h>
+#include <linux/rwsem.h>
+#include <linux/slab.h>    // kmalloc(),kfree()
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/uaccess.h> // copy_to_user, copy_from_user
+#include <linux/wait.h>
+#else
+#include "scull_user.h"
+#endif
+
+#include "scull.h"
+
+/*
+ * Locking. dev->sem guards the shape of the device: I/O holds it for
+ * reading, and anything that frees list items or quanta (trim, hole
+ * punch, truncate, reclaim) holds it for writing. Under the read side:
+ *
+ *  - the list is only ever appended to, under dev->list_lock, and is
+ *    published like an RCU list, so lookups walk it without a lock;
+ *  - the quanta of a list item, its data array and its discard bits
+ *    belong to the stripe of its item number, so writers to different
+ *    qsets run in parallel;
+ *  - dev->size only grows, with a cmpxchg loop, and the counters are
+ *    per CPU.
+ */
+
+static struct mutex *scull_stripe(struct scull_dev *dev, long item) {
+    return &dev->stripe[item % SCULL_STRIPES].lock;
+}
+
+static struct list_head *scull_next(struct list_head *pos) {
+    return rcu_dereference_raw(list_next_rcu(pos));
+}
+
+static void scull_grow(struct scull_dev *dev, long size) {
+    long old = atomic_long_read(&dev->size);
+
+    while (old < size && !atomic_long_try_cmpxchg(&dev->size, &old, size))
+        ;
+}
+
+void scull_get_stats(struct scull_dev *dev, struct scull_stats *stats) {
+    struct scull_stats *c;
+    int cpu;
+
+    memset(stats, 0, sizeof(*stats));
+    for_each_possible_cpu(cpu) {
+        c = per_cpu_ptr(dev->stats, cpu);
+        stats->reads += c->reads;
+        stats->writes += c->writes;
+        stats->allocs += c->allocs;
+        stats->frees += c->frees;
+        stats->reclaimed += c->reclaimed;
+        stats->checked += c->checked;
+        stats->crc_errors += c->crc_errors;
+    }
+}
+
+/*
+ * Free a list item and whatever quanta it still holds.
+ */
+
+static void scull_free_qset(struct scull_dev *dev, struct scull_qset *dptr) {
+    int i;
+
+    if (dptr->data) {
+        for (i = 0; i < dev->qset; i++)
+            if (dptr->data[i]) {
+                kfree(dptr->data[i]);
+                atomic_long_sub(dev->quantum, &dev->mem);
+                this_cpu_inc(dev->stats->frees);
+            }
+        kfree(dptr->data);
+        this_cpu_inc(dev->stats->frees);
+    }
+    kfree(dptr->sum);
+    kfree(dptr->discard);
+    list_del(&dptr->list);
+    kfree(dptr);
+    this_cpu_inc(dev->stats->frees);
+}
+
+/*
+ * Empty out the scull device; must be called with the device
+ * semaphore held for writing. The device takes up the geometry it is
+ * configured with, unless that no longer passes scull_check_geometry:
+ * the module parameters may be caught halfway through a change, and a
+ * new scull_aligned may round the quantum up past the limits.
+ */
+
+int scull_trim(struct scull_dev *dev) {
+    struct scull_qset *next, *dptr;
+    int quantum, qset;
+
+    // all the list items
+    list_for_each_entry_safe(dptr, next, &dev->qsets, list)
+        scull_free_qset(dev, dptr);
+    atomic_long_set(&dev->nr_discardable, 0);
+    atomic_long_set(&dev->size, 0);
+    quantum = scull_layout_quantum(dev->cfg_quantum ? dev->cfg_quantum : READ_ONCE(scull_quantum));
+    qset = dev->cfg_qset ? dev->cfg_qset : READ_ONCE(scull_qset);
+    if (!scull_check_geometry(quantum, qset)) {
+        dev->quantum = quantum;
+        dev->qset = qset;
+    }
+    dev->crc = scull_crc;
+    dev->gen++; // every cached cursor is stale now
+    dev->epoch++;
+    return 0;
+}
+
+/*
+ * The quantum size a device really uses. In an aligned layout it is
+ * rounded up to whole cache lines or pages; kmalloc hands out memory
+ * aligned to the size class for such sizes, so every quantum then starts
+ * on a cache line (page) and quantum-sized transfers never straddle one.
+ */
+
+int scull_layout_quantum(int quantum) {
+    switch (scull_aligned) {
+    case SCULL_ALIGN_CACHE:
+        return ALIGN(quantum, L1_CACHE_BYTES);
+    case SCULL_ALIGN_PAGE:
+        return ALIGN(quantum, PAGE_SIZE);
+    default:
+        return quantum;
+    }
+}
+
+/*
+ * The checksums of a quantum, one per SCULL_CRC_BLOCK
+ */
+
+static int scull_sum_blocks(struct scull_dev *dev) {
+    return DIV_ROUND_UP(dev->quantum, SCULL_CRC_BLOCK);
+}
+
+static struct scull_sum *scull_sums(struct scull_dev *dev, struct scull_qset *dptr, int s_pos) {
+    return dptr->sum + s_pos * scull_sum_blocks(dev);
+}
+
+/*
+ * Whether a device can take this geometry: the quanta, and the data and
+ * checksum arrays of each list item, all have to come from kmalloc.
+ */
+
+int scull_check_geometry(long quantum, long qset) {
+    if (quantum <= 0 || qset <= 0 || quantum > INT_MAX / qset || quantum > KMALLOC_MAX_SIZE)
+        return -EINVAL;
+    if (qset > KMALLOC_MAX_SIZE / sizeof(char *) ||
+        qset > KMALLOC_MAX_SIZE / (DIV_ROUND_UP(quantum, SCULL_CRC_BLOCK) * sizeof(struct scull_sum)))
+        return -EINVAL;
+    return 0;
+}
+
+/*
+ * Memory of a device always comes from the device's own node.
+ * Every allocation is counted, for SCULL_IOCGSTATS.
+ */
+
+static struct scull_qset *scull_alloc_qset(struct scull_dev *dev) {
+    struct scull_qset *qs = kmalloc_node(sizeof(struct scull_qset), GFP_KERNEL, dev->node);
+
+    if (qs) {
+        memset(qs, 0, sizeof(struct scull_qset));
+        this_cpu_inc(dev->stats->allocs);
+    }
+    return qs;
+}
+
+static int scull_alloc_data(struct scull_dev *dev, struct scull_qset *dptr) {
+    struct scull_sum *sum = NULL;
+    void **data;
+    size_t n;
+
+    if (dev->crc) {
+        n = dev->qset * scull_sum_blocks(dev) * sizeof(*sum);
+        sum = kmalloc_node(n, GFP_KERNEL, dev->node);
+        if (!sum)
+            return -ENOMEM;
+        memset(sum, 0, n);
+    }
+    data = kmalloc_node(dev->qset * sizeof(char *), GFP_KERNEL, dev->node);
+    if (!data) {
+        kfree(sum);
+        return -ENOMEM;
+    }
+    memset(data, 0, dev->qset * sizeof(char *));
+    this_cpu_inc(dev->stats->allocs);
+    dptr->sum = sum;
+    dptr->data = data;
+    return 0;
+}
+
+/*
+ * Quanta count against the memory limit of the device; a device at its
+ * limit is full (-ENOSPC) rather than out of memory. A new quantum is
+ * zeroed: whatever part of it is not written reads as a hole would,
+ * after a write past the end or a truncate that grows the device.
+ */
+
+static int scull_alloc_quantum(struct scull_dev *dev, struct scull_qset *dptr, int s_pos) {
+    long mem = atomic_long_add_return(dev->quantum, &dev->mem);
+
+    if (dev->limit && mem > dev->limit) {
+        atomic_long_sub(dev->quantum, &dev->mem);
+        return -ENOSPC;
+    }
+    dptr->data[s_pos] = kmalloc_node(dev->quantum, GFP_KERNEL, dev->node);
+    if (!dptr->data[s_pos]) {
+        atomic_long_sub(dev->quantum, &dev->mem);
+        return -ENOMEM;
+    }
+    memset(dptr->data[s_pos], 0, dev->quantum);
+    this_cpu_inc(dev->stats->allocs);
+    return 0;
+}
+
+/*
+ * Discardable quanta hold data the owner can recreate: the shrinker may
+ * free them under memory pressure, after which they read as holes. Only
+ * quanta lying entirely inside the range are marked, and writing to a
+ * quantum makes it precious again. Called with the device semaphore
+ * held for writing.
+ */
+
+int scull_mark_discardable(struct scull_dev *dev, loff_t start, loff_t len) {
+    struct scull_qset *dptr;
+    int quantum = dev->quantum, qset = dev->qset;
+    long first, last;
+    int s_pos, end;
+
+    if (start < 0 || len < 0)
+        return -EINVAL;
+    first = DIV_ROUND_UP((long) start, quantum); // first whole quantum
+    last = ((long) start + (long) len) / quantum; // one past the last one
+    last = min(last, (long) DIV_ROUND_UP(atomic_long_read(&dev->size), quantum));
+
+    list_for_each_entry(dptr, &dev->qsets, list) {
+        if (dptr->item * qset >= last)
+            break;
+        if ((dptr->item + 1) * qset <= first || !dptr->data)
+            continue;
+        s_pos = max(first - dptr->item * qset, 0L);
+        end = min(last - dptr->item * qset, (long) qset);
+        for (; s_pos < end; s_pos++) {
+            if (!dptr->data[s_pos])
+                continue;
+            if (!dptr->discard) {
+                dptr->discard = kmalloc_node(BITS_TO_LONGS(qset) * sizeof(long), GFP_KERNEL, dev->node);
+                if (!dptr->discard)
+                    return -ENOMEM;
+                memset(dptr->discard, 0, BITS_TO_LONGS(qset) * sizeof(long));
+            }
+            if (!test_bit(s_pos, dptr->discard)) {
+                __set_bit(s_pos, dptr->discard);
+                atomic_long_inc(&dev->nr_discardable);
+            }
+        }
+    }
+    return 0;
+}
+
+static void scull_undiscard(struct scull_dev *dev, struct scull_qset *dptr, int s_pos) {
+    if (dptr->discard && test_bit(s_pos, dptr->discard)) {
+        __clear_bit(s_pos, dptr->discard);
+        atomic_long_dec(&dev->nr_discardable);
+    }
+}
+
+static void scull_free_quantum(struct scull_dev *dev, struct scull_qset *dptr, int s_pos) {
+    scull_undiscard(dev, dptr, s_pos);
+    kfree(dptr->data[s_pos]);
+    dptr->data[s_pos] = NULL;
+    atomic_long_sub(dev->quantum, &dev->mem);
+    if (dptr->sum)
+        memset(scull_sums(dev, dptr, s_pos), 0, scull_sum_blocks(dev) * sizeof(*dptr->sum));
+    this_cpu_inc(dev->stats->frees);
+}
+
+/*
+ * Checksums. With dev->crc set, every SCULL_CRC_BLOCK bytes of a quantum
+ * carry the CRC32C of the first sum->len bytes of the block: everything
+ * ever written to it, plus whatever gaps lie in between. A write only
+ * marks the blocks it touches stale; a stale block is summed on its
+ * first read or at the next scrub, whichever comes first, so writes pay
+ * nothing and a block rewritten many times is summed once. From then on
+ * every scrub verifies it. The price is that damage done to a block
+ * before it is summed goes unnoticed. All of this runs under the stripe
+ * of the qset.
+ */
+
+static void scull_sum_write(struct scull_dev *dev, struct scull_qset *dptr, int s_pos, int q_pos, int count) {
+    struct scull_sum *sum = scull_sums(dev, dptr, s_pos) + q_pos / SCULL_CRC_BLOCK;
+    int lo = q_pos % SCULL_CRC_BLOCK, hi;
+
+    for (; count > 0; sum++, lo = 0) {
+        hi = min(lo + count, SCULL_CRC_BLOCK);
+        sum->len = max_t(int, sum->len, hi);
+        sum->stale = true;
+        sum->verified = false;
+        count -= hi - lo;
+    }
+}
+
+static int scull_sum_check(struct scull_dev *dev, struct scull_qset *dptr, int s_pos, int b) {
+    struct scull_sum *sum = scull_sums(dev, dptr, s_pos) + b;
+
+    if (sum->stale) { // nothing to check against yet
+        sum->crc = crc32c(0, (char *) dptr->data[s_pos] + b * SCULL_CRC_BLOCK, sum->len);
+        sum->stale = false;
+        sum->verified = true;
+        return 0;
+    }
+    this_cpu_inc(dev->stats->checked);
+    if (crc32c(0, (char *) dptr->data[s_pos] + b * SCULL_CRC_BLOCK, sum->len) != sum->crc) {
+        this_cpu_inc(dev->stats->crc_errors);
+        pr_warn_ratelimited("scull%d: checksum mismatch in quantum %ld, block %d\n",
+                            dev->index, dptr->item * dev->qset + s_pos, b);
+        return -EIO;
+    }
+    sum->verified = true;
+    return 0;
+}
+
+static int scull_sum_read(struct scull_dev *dev, struct scull_qset *dptr, int s_pos, int q_pos, int count) {
+    struct scull_sum *sum;
+    int b;
+
+    if (!dptr->sum)
+        return 0;
+    sum = scull_sums(dev, dptr, s_pos);
+    for (b = q_pos / SCULL_CRC_BLOCK; b * SCULL_CRC_BLOCK < q_pos + count; b++)
+        if (!sum[b].verified && scull_sum_check(dev, dptr, s_pos, b))
+            return -EIO;
+    return 0;
+}
+
+/*
+ * Verify every quantum of the device, whether it was read or not, and sum
+ * the blocks written since the last scrub; returns the number of
+ * mismatches. Called with the device semaphore held for reading.
+ */
+
+unsigned long scull_scrub(struct scull_dev *dev) {
+    struct list_head *pos;
+    struct scull_qset *dptr;
+    unsigned long bad = 0;
+    int s_pos, b;
+
+    for (pos = scull_next(&dev->qsets); pos != &dev->qsets; pos = scull_next(pos)) {
+        dptr = list_entry(pos, struct scull_qset, list);
+        mutex_lock(scull_stripe(dev, dptr->item));
+        for (s_pos = 0; dptr->sum && s_pos < dev->qset; s_pos++)
+            for (b = 0; dptr->data[s_pos] && b < scull_sum_blocks(dev); b++)
+                if (scull_sum_check(dev, dptr, s_pos, b))
+                    bad++;
+        mutex_unlock(scull_stripe(dev, dptr->item));
+        cond_resched();
+    }
+    return bad;
+}
+
+/*
+ * Free up to nr discardable quanta, oldest offsets first; returns how
+ * many went. Called with the device semaphore held for writing.
+ */
+
+unsigned long scull_reclaim(struct scull_dev *dev, unsigned long nr) {
+    struct scull_qset *dptr;
+    unsigned long freed = 0;
+    int i;
+
+    list_for_each_entry(dptr, &dev->qsets, list) {
+        if (freed == nr || !atomic_long_read(&dev->nr_discardable))
+            break;
+        if (!dptr->discard)
+            continue;
+        for_each_set_bit(i, dptr->discard, dev->qset) {
+            scull_free_quantum(dev, dptr, i);
+            this_cpu_inc(dev->stats->reclaimed);
+            if (++freed == nr)
+                break;
+        }
+    }
+    return freed;
+}
+
+/*
+ * Zero [lo, hi), which lies within a single quantum, if that quantum is
+ * there.
+ */
+
+static void scull_zero(struct scull_dev *dev, long lo, long hi) {
+    long q = lo / dev->quantum;
+    struct scull_qset *dptr = scull_follow(dev, q / dev->qset, 0);
+
+    if (dptr && dptr->data && dptr->data[q % dev->qset]) {
+        memset(dptr->data[q % dev->qset] + lo % dev->quantum, 0, hi - lo);
+        if (dptr->sum)
+            scull_sum_write(dev, dptr, q % dev->qset, lo % dev->quantum, hi - lo);
+    }
+}
+
+/*
+ * Punch a hole: free every quantum lying entirely inside the range and
+ * zero the bytes the range covers in the quanta at its edges, so the
+ * range reads back as holes or zeroes. The size does not change. List
+ * items left without quanta are unlinked and freed. Called with the
+ * device semaphore held for writing.
+ */
+
+int scull_punch(struct scull_dev *dev, loff_t start, loff_t len) {
+    struct scull_qset *dptr, *next;
+    int quantum = dev->quantum, qset = dev->qset;
+    long first, last, end, size = atomic_long_read(&dev->size);
+    int s_pos, stop, collapsed = 0;
+
+    if (start < 0 || len < 0)
+        return -EINVAL;
+    end = min((long) start + (long) len, size);
+    if (start >= end)
+        return 0;
+    dev->epoch++; // data is gone, the key-value index with it
+    first = DIV_ROUND_UP((long) start, quantum); // first whole quantum
+    // one past the last one; the quantum holding the end of data goes too
+    last = end == size ? DIV_ROUND_UP(end, quantum) : end / quantum;
+    if (first > last) { // all inside one quantum
+        scull_zero(dev, start, end);
+        return 0;
+    }
+    if (start < first * quantum)
+        scull_zero(dev, start, first * quantum);
+    if (end > last * quantum)
+        scull_zero(dev, last * quantum, end);
+
+    list_for_each_entry_safe(dptr, next, &dev->qsets, list) {
+        if (dptr->item * qset >= last)
+            break;
+        if ((dptr->item + 1) * qset <= first)
+            continue;
+        if (dptr->data) {
+            s_pos = max(first - dptr->item * qset, 0L);
+            stop = min(last - dptr->item * qset, (long) qset);
+            for (; s_pos < stop; s_pos++) {
+                if (dptr->data[s_pos])
+                    scull_free_quantum(dev, dptr, s_pos);
+            }
+            for (s_pos = 0; s_pos < qset && !dptr->data[s_pos]; s_pos++)
+                ;
+            if (s_pos < qset)
+                continue; // still holds data outside the range
+        }
+        scull_free_qset(dev, dptr);
+        collapsed = 1;
+    }
+    if (collapsed)
+        dev->gen++; // cursors may point at freed items
+    return 0;
+}
+
+/*
+ * Set the size of the device. Growing leaves a hole; shrinking frees the
+ * quanta past the new end and zeroes the rest of the one it falls in, so
+ * growing again never brings old data back. The list is walked from its
+ * tail, so the cost depends on what is freed, not on the device size.
+ * Called with the device semaphore held for writing.
+ */
+
+int scull_truncate(struct scull_dev *dev, loff_t size) {
+    struct scull_qset *dptr, *prev;
+    int quantum = dev->quantum, qset = dev->qset;
+    long keep; // quanta that stay
+    int s_pos, q_pos, collapsed = 0;
+
+    if (size < 0)
+        return -EINVAL;
+    if (size >= atomic_long_read(&dev->size)) {
+        atomic_long_set(&dev->size, size);
+        return 0;
+    }
+    dev->epoch++;
+    keep = DIV_ROUND_UP((long) size, quantum);
+    q_pos = size % quantum;
+
+    list_for_each_entry_safe_reverse(dptr, prev, &dev->qsets, list) {
+        s_pos = (keep - 1) % qset;
+        if (q_pos && dptr->item == (keep - 1) / qset && dptr->data && dptr->data[s_pos]) {
+            memset(dptr->data[s_pos] + q_pos, 0, quantum - q_pos);
+            if (dptr->sum)
+                scull_sum_write(dev, dptr, s_pos, q_pos, quantum - q_pos);
+        }
+        if ((dptr->item + 1) * qset <= keep)
+            break;
+        if (dptr->data && dptr->item * qset < keep) {
+            for (s_pos = keep - dptr->item * qset; s_pos < qset; s_pos++) {
+                if (dptr->data[s_pos])
+                    scull_free_quantum(dev, dptr, s_pos);
+            }
+            for (s_pos = 0; s_pos < qset && !dptr->data[s_pos]; s_pos++)
+                ;
+            if (s_pos < qset)
+                break; // the new last item
+        }
+        scull_free_qset(dev, dptr);
+        collapsed = 1;
+    }
+    atomic_long_set(&dev->size, size);
+    if (collapsed)
+        dev->gen++;
+    return 0;
+}
+
+/*
+ * The list is sparse and sorted by item number: holes punched out of
+ * the device leave no list items behind. Look item n up, starting from
+ * qs (whose item must not be past n) or from the head when qs is NULL,
+ * and insert it in its place if it is missing and alloc is set.
+ * The walk takes no lock; only an insertion takes dev->list_lock, and
+ * then looks again in case another writer got there first.
+ */
+
+static struct scull_qset *scull_find(struct scull_dev *dev, struct list_head *pos, long n,
+                                     struct list_head **where) {
+    struct scull_qset *qs;
+
+    for (; pos != &dev->qsets; pos = scull_next(pos)) {
+        qs = list_entry(pos, struct scull_qset, list);
+        if (qs->item == n)
+            return qs;
+        if (qs->item > n)
+            break;
+    }
+    *where = pos; // the first item past n, or the head
+    return NULL;
+}
+
+static struct scull_qset *scull_follow_from(struct scull_dev *dev, struct scull_qset *from,
+                                            long n, int alloc) {
+    struct scull_qset *qs;
+    struct list_head *pos;
+
+    qs = scull_find(dev, from ? &from->list : scull_next(&dev->qsets), n, &pos);
+    if (qs || !alloc)
+        return qs;
+
+    mutex_lock(&dev->list_lock);
+    qs = scull_find(dev, from ? &from->list : scull_next(&dev->qsets), n, &pos);
+    if (!qs) {
+        qs = scull_alloc_qset(dev);
+        if (qs) {
+            qs->item = n;
+            list_add_tail_rcu(&qs->list, pos); // right before the first item past n
+        }
+    }
+    mutex_unlock(&dev->list_lock);
+    return qs;
+}
+
+struct scull_qset *scull_follow(struct scull_dev *dev, long n, int alloc) {
+    return scull_follow_from(dev, NULL, n, alloc);
+}
+
+/*
+ * Follow the list, starting from the qset this file resolved last time
+ * when it is still there and not past the one we look for. Items are
+ * only freed by a trim, a hole punch or a truncate, and all of them bump
+ * the generation, so a cursor with the current generation always points
+ * into the list. Streaming reads and writes then cost O(1) list steps
+ * each instead of O(position). Threads sharing a file share the cursor,
+ * hence its spinlock.
+ */
+
+static struct scull_qset *scull_cursor(struct scull_file *sf, long n) {
+    struct scull_qset *from = NULL;
+
+    spin_lock(&sf->lock);
+    if (sf->dptr && sf->gen == sf->dev->gen && n >= sf->item)
+        from = sf->dptr;
+    spin_unlock(&sf->lock);
+    return from;
+}
+
+static void scull_set_cursor(struct scull_file *sf, struct scull_qset *qs) {
+    spin_lock(&sf->lock);
+    sf->dptr = qs;
+    sf->item = qs->item;
+    sf->gen = sf->dev->gen;
+    spin_unlock(&sf->lock);
+}
+
+struct scull_qset *scull_follow_cached(struct scull_file *sf, long n, int alloc) {
+    struct scull_qset *qs = scull_follow_from(sf->dev, scull_cursor(sf, n), n, alloc);
+
+    if (qs)
+        scull_set_cursor(sf, qs);
+    return qs;
+}
+
+/*
+ * A sequential reader is about to finish this quantum: warm up
+ * whatever the next read() is going to chase.
+ */
+
+static void scull_prefetch_next(struct scull_dev *dev, struct scull_qset *dptr, int s_pos) {
+    if (s_pos + 1 < dev->qset) {
+        if (dptr->data[s_pos + 1])
+            prefetch(dptr->data[s_pos + 1]);
+    } else if (scull_next(&dptr->list) != &dev->qsets) {
+        prefetch(scull_next(&dptr->list));
+    }
+}
+
+/*
+ * Data management: read and write
+ */
+
+/*
+ * Read and write one quantum's worth at *f_pos; both must be called
+ * with the device semaphore held for reading, and take the stripe of
+ * the qset they touch. They are shared by read(), write() and the
+ * batch ioctl in main.c.
+ */
+
+/*
+ * Fast paths for transfers that start on a quantum boundary and cover at
+ * least one whole quantum: copy quantum after quantum, stepping along the
+ * qset instead of resolving each one from the offset again. The first
+ * quantum must be there; they stop at the last whole quantum, at the end
+ * of the qset (whose stripe is all they hold), at a hole (reads) or when
+ * memory runs out (writes).
+ */
+
+static ssize_t scull_read_quanta(struct scull_file *sf, struct scull_qset *dptr, int s_pos,
+                                 char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_dev *dev = sf->dev;
+    size_t quantum = dev->quantum, done = 0;
+
+    for (;;) {
+        scull_prefetch_next(dev, dptr, s_pos);
+        if (scull_sum_read(dev, dptr, s_pos, 0, quantum)) {
+            if (!done)
+                return -EIO;
+            break;
+        }
+        if (copy_to_user(buf + done, dptr->data[s_pos], quantum)) {
+            if (!done)
+                return -EFAULT;
+            break;
+        }
+        done += quantum;
+        if (count - done < quantum || ++s_pos == dev->qset)
+            break;
+        if (!dptr->data[s_pos])
+            break; // don't fill holes
+    }
+    *f_pos += done;
+    sf->next_pos = *f_pos;
+    return done;
+}
+
+static ssize_t scull_write_quanta(struct scull_file *sf, struct scull_qset *dptr, int s_pos,
+                                  const char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_dev *dev = sf->dev;
+    size_t quantum = dev->quantum, done = 0;
+    unsigned long left;
+
+    for (;;) {
+        scull_undiscard(dev, dptr, s_pos);
+        left = copy_from_user(dptr->data[s_pos], buf + done, quantum);
+        if (dptr->sum) // even a faulting copy may have changed some bytes
+            scull_sum_write(dev, dptr, s_pos, 0, quantum);
+        if (left) {
+            if (!done)
+                return -EFAULT;
+            break;
+        }
+        done += quantum;
+        if (count - done < quantum || ++s_pos == dev->qset)
+            break;
+        if (!dptr->data[s_pos] && scull_alloc_quantum(dev, dptr, s_pos))
+            break;
+    }
+    *f_pos += done;
+    return done;
+}
+
+ssize_t scull_do_read(struct scull_file *sf, char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_qset *dptr; // the first listitem
+    struct mutex *stripe;
+    int quantum = dev->quantum, qset = dev->qset;
+    int itemsize = quantum * qset; // how many bytes in the listitem
+    long item, size = atomic_long_read(&dev->size);
+    int s_pos, q_pos, rest;
+    ssize_t retval = 0;
+
+    this_cpu_inc(dev->stats->reads);
+    if (*f_pos >= size)
+        return 0;
+    if (*f_pos + count > size)
+        count = size - *f_pos;
+
+    // find listitem, qset index, and offset in the quantum
+    item = (long) *f_pos / itemsize;
+    rest = (long) *f_pos % itemsize;
+    s_pos = rest / quantum;
+    q_pos = rest % quantum;
+
+    // follow the list up to the right position
+    dptr = scull_follow_cached(sf, item, 0);
+    if (dptr == NULL)
+        return 0; // don't fill holes
+
+    stripe = scull_stripe(dev, item);
+    mutex_lock(stripe);
+    if (!dptr->data || !dptr->data[s_pos])
+        goto out; // don't fill holes
+
+    if (q_pos == 0 && count >= quantum) {
+        retval = scull_read_quanta(sf, dptr, s_pos, buf, count, f_pos);
+        goto out;
+    }
+
+    // read only up to the end of this quantum
+    if (count > quantum - q_pos)
+        count = quantum - q_pos;
+
+    // sequential readers get the next quantum warmed up while copying
+    if (*f_pos == sf->next_pos && q_pos + count == quantum)
+        scull_prefetch_next(dev, dptr, s_pos);
+
+    if (scull_sum_read(dev, dptr, s_pos, q_pos, count)) {
+        retval = -EIO;
+        goto out;
+    }
+    if (copy_to_user(buf, dptr->data[s_pos] + q_pos, count)) {
+        retval = -EFAULT;
+        goto out;
+    }
+    *f_pos += count;
+    sf->next_pos = *f_pos; // only a hint, shared by threads at their peril
+    retval = count;
+
+out:
+    mutex_unlock(stripe);
+    return retval;
+}
+
+ssize_t scull_do_write(struct scull_file *sf, const char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_qset *dptr;
+    struct mutex *stripe;
+    int quantum = dev->quantum, qset = dev->qset;
+    int itemsize = quantum * qset;
+    int s_pos, q_pos, rest;
+    ssize_t retval = -ENOMEM;
+    unsigned long left;
+    long item;
+
+    this_cpu_inc(dev->stats->writes);
+
+    // find listitem, qset index and offset in the quantum
+    item = (long) *f_pos / itemsize;
+    rest = (long) *f_pos % itemsize;
+    s_pos = rest / quantum;
+    q_pos = rest % quantum;
+
+    // follow the list up to the right position, appends resume from the cursor
+    dptr = scull_follow_cached(sf, item, 1);
+    if (dptr == NULL)
+        return -ENOMEM;
+
+    stripe = scull_stripe(dev, item);
+    mutex_lock(stripe);
+    if (!dptr->data && scull_alloc_data(dev, dptr))
+        goto out;
+    if (!dptr->data[s_pos]) {
+        retval = scull_alloc_quantum(dev, dptr, s_pos);
+        if (retval)
+            goto out;
+    }
+    if (q_pos == 0 && count >= quantum) {
+        retval = scull_write_quanta(sf, dptr, s_pos, buf, count, f_pos);
+        goto out;
+    }
+
+    // write only up to the end of this quantum
+    if (count > quantum - q_pos)
+        count = quantum - q_pos;
+
+    scull_undiscard(dev, dptr, s_pos);
+    left = copy_from_user(dptr->data[s_pos] + q_pos, buf, count);
+    if (dptr->sum)
+        scull_sum_write(dev, dptr, s_pos, q_pos, count);
+    if (left) {
+        retval = -EFAULT;
+        goto out;
+    }
+    *f_pos += count;
+    retval = count;
+
+out:
+    mutex_unlock(stripe);
+    // update the size
+    if (retval > 0)
+        scull_grow(dev, *f_pos);
+    return retval;
+}
+
+/*
+ * Direct transfers, for large reads and writes. The user buffer is
+ * pinned SCULL_DIRECT_PAGES pages at a time and the data moved between
+ * those pages and the quanta with plain memcpy, each list item under a
+ * single hold of its stripe, instead of with one copy_*_user (and its
+ * fault handling) per quantum. Unlike scull_do_read() and
+ * scull_do_write() these go on past the end of a list item, and only
+ * stop at the end of the data, a hole, or an error.
+ */
+
+static void scull_pages_copy(struct page **pages, size_t off, char *p, size_t n, int to_pages) {
+    size_t in, chunk;
+    char *addr;
+
+    while (n) {
+        in = off % PAGE_SIZE;
+        chunk = min(n, PAGE_SIZE - in);
+        addr = kmap_local_page(pages[off / PAGE_SIZE]);
+        if (to_pages)
+            memcpy(addr + in, p, chunk);
+        else
+            memcpy(p, addr + in, chunk);
+        kunmap_local(addr);
+        off += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+/*
+ * Move len bytes between the device at pos and the pinned pages,
+ * starting at off in the first page. Returns the bytes moved, or an
+ * error if none were.
+ */
+
+static long scull_direct_copy(struct scull_file *sf, struct page **pages, size_t off, size_t len,
+                              loff_t pos, int write) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_qset *dptr;
+    struct mutex *stripe;
+    int quantum = dev->quantum, qset = dev->qset;
+    int itemsize = quantum * qset;
+    int s_pos, q_pos, rest;
+    size_t done = 0, chunk;
+    long item, retval = 0;
+
+    while (done < len && !retval) {
+        item = (long) (pos + done) / itemsize;
+        rest = (long) (pos + done) % itemsize;
+        s_pos = rest / quantum;
+        q_pos = rest % quantum;
+
+        dptr = scull_follow_cached(sf, item, write);
+        if (dptr == NULL) {
+            retval = write ? -ENOMEM : 1; // a read stops at the hole
+            break;
+        }
+        stripe = scull_stripe(dev, item);
+        mutex_lock(stripe);
+        if (write && !dptr->data && scull_alloc_data(dev, dptr))
+            retval = -ENOMEM;
+        for (; !retval && s_pos < qset && done < len; s_pos++, q_pos = 0) {
+            chunk = min_t(size_t, quantum - q_pos, len - done);
+            if (write) {
+                if (!dptr->data[s_pos]) {
+                    retval = scull_alloc_quantum(dev, dptr, s_pos);
+                    if (retval)
+                        break;
+                }
+                scull_undiscard(dev, dptr, s_pos);
+                scull_pages_copy(pages, off + done, dptr->data[s_pos] + q_pos, chunk, 0);
+                if (dptr->sum)
+                    scull_sum_write(dev, dptr, s_pos, q_pos, chunk);
+            } else {
+                if (!dptr->data || !dptr->data[s_pos]) {
+                    retval = 1;
+                    break;
+                }
+                if (scull_sum_read(dev, dptr, s_pos, q_pos, chunk)) {
+                    retval = -EIO;
+                    break;
+                }
+                scull_pages_copy(pages, off + done, dptr->data[s_pos] + q_pos, chunk, 1);
+            }
+            done += chunk;
+        }
+        mutex_unlock(stripe);
+        if (write && done)
+            scull_grow(dev, pos + done);
+    }
+    if (done || retval > 0)
+        return done;
+    return retval;
+}
+
+static ssize_t scull_direct(struct scull_file *sf, char __user *buf, size_t count, loff_t *f_pos, int write) {
+    struct page *pages[SCULL_DIRECT_PAGES];
+    unsigned long start;
+    size_t done = 0, off, len;
+    long ret = 0;
+    int nr, pinned;
+
+    while (done < count) {
+        start = (unsigned long) buf + done;
+        off = start % PAGE_SIZE;
+        nr = min_t(size_t, DIV_ROUND_UP(off + count - done, PAGE_SIZE), SCULL_DIRECT_PAGES);
+        // reading from the device writes to the pages
+        pinned = pin_user_pages_fast(start - off, nr, write ? 0 : FOLL_WRITE, pages);
+        if (pinned <= 0) {
+            ret = pinned ? pinned : -EFAULT;
+            break;
+        }
+        len = min(count - done, pinned * PAGE_SIZE - off);
+        ret = scull_direct_copy(sf, pages, off, len, *f_pos + done, write);
+        unpin_user_pages_dirty_lock(pages, pinned, !write);
+        if (ret > 0)
+            done += ret;
+        if (ret != len)
+            break;
+    }
+    *f_pos += done;
+    return done ? done : ret;
+}
+
+ssize_t scull_direct_read(struct scull_file *sf, char __user *buf, size_t count, loff_t *f_pos) {
+    struct scull_dev *dev = sf->dev;
+    long size = atomic_long_read(&dev->size);
+    ssize_t retval;
+
+    this_cpu_inc(dev->stats->reads);
+    if (*f_pos >= size)
+        return 0;
+    if (*f_pos + count > size)
+        count = size - *f_pos;
+    retval = scull_direct(sf, buf, count, f_pos, 0);
+    if (retval > 0)
+        sf->next_pos = *f_pos;
+    return retval;
+}
+
+ssize_t scull_direct_write(struct scull_file *sf, const char __user *buf, size_t count, loff_t *f_pos) {
+    this_cpu_inc(sf->dev->stats->writes);
+    return scull_direct(sf, (char __user *) buf, count, f_pos, 1);
+}
+
+/*
+ * Export and import. The stream (see scull_ioctl.h) carries the layout
+ * and the allocated quanta only, so moving a device costs what it holds
+ * rather than its size. The position starts at 0 for the header and is
+ * one past the index of the last quantum moved after that.
+ *
+ * Export is called with the device semaphore held for reading. Quanta
+ * are checked against their checksums on the way out, like reads.
+ */
+
+long scull_export(struct scull_file *sf, char __user *buf, size_t len, u64 *pos) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_stream_hdr hdr;
+    struct scull_stream_rec rec;
+    struct scull_qset *dptr, *from, *moved = NULL;
+    struct list_head *lp;
+    int quantum = dev->quantum, qset = dev->qset;
+    long size = atomic_long_read(&dev->size), last, q;
+    long retval = 0;
+    size_t done = 0;
+    int s_pos;
+
+    if (*pos == 0) {
+        hdr = (struct scull_stream_hdr) {SCULL_STREAM_MAGIC, SCULL_STREAM_VERSION, quantum, qset, size};
+        if (len < sizeof(hdr))
+            return -ENOSPC;
+        if (copy_to_user(buf, &hdr, sizeof(hdr)))
+            return -EFAULT;
+        done = sizeof(hdr);
+        *pos = 1;
+    }
+    last = DIV_ROUND_UP(size, quantum); // quanta past the size are not moved
+    q = *pos - 1;
+
+    // resume the walk from where the last call left off
+    from = scull_cursor(sf, q / qset);
+    dptr = scull_find(dev, from ? &from->list : scull_next(&dev->qsets), q / qset, &lp);
+    for (lp = dptr ? &dptr->list : lp; lp != &dev->qsets && !retval; lp = scull_next(lp)) {
+        dptr = list_entry(lp, struct scull_qset, list);
+        if (dptr->item * qset >= last)
+            break;
+        if (!dptr->data)
+            continue;
+        mutex_lock(scull_stripe(dev, dptr->item));
+        for (s_pos = max(q - dptr->item * qset, 0L); s_pos < qset; s_pos++) {
+            rec = (struct scull_stream_rec) {dptr->item * qset + s_pos};
+            if (rec.quantum >= last)
+                break;
+            if (!dptr->data[s_pos])
+                continue;
+            rec.len = min((long) quantum, size - (long) rec.quantum * quantum);
+            if (done + sizeof(rec) + rec.len > len) {
+                retval = -ENOSPC; // this one goes first next time
+                break;
+            }
+            if (scull_sum_read(dev, dptr, s_pos, 0, rec.len)) {
+                retval = -EIO;
+                break;
+            }
+            if (copy_to_user(buf + done, &rec, sizeof(rec)) ||
+                copy_to_user(buf + done + sizeof(rec), dptr->data[s_pos], rec.len)) {
+                retval = -EFAULT;
+                break;
+            }
+            this_cpu_inc(dev->stats->reads);
+            done += sizeof(rec) + rec.len;
+            *pos = rec.quantum + 2;
+            moved = dptr;
+        }
+        mutex_unlock(scull_stripe(dev, dptr->item));
+        cond_resched();
+    }
+    if (moved)
+        scull_set_cursor(sf, moved);
+    if (!retval)
+        *pos = max_t(u64, *pos, last + 1); // the next call ends the stream right away
+    return done ? done : retval;
+}
+
+/*
+ * Start an import: check the header and make the device an empty one
+ * with the stream's layout and size. Called with the device semaphore
+ * held for writing.
+ */
+
+int scull_import_start(struct scull_dev *dev, const struct scull_stream_hdr *hdr) {
+    if (hdr->magic != SCULL_STREAM_MAGIC || hdr->version != SCULL_STREAM_VERSION)
+        return -EINVAL;
+    if (scull_check_geometry(hdr->quantum, hdr->qset) || hdr->size > LLONG_MAX)
+        return -EINVAL;
+    scull_trim(dev);
+    dev->quantum = hdr->quantum;
+    dev->qset = hdr->qset;
+    atomic_long_set(&dev->size, hdr->size);
+    return 0;
+}
+
+/*
+ * Import the whole records at buf. Records of the same qset are put in
+ * under one stripe hold, with the qset looked up (and allocated) once;
+ * the list walk resumes from the file's cursor, so a stream in index
+ * order is rebuilt in one pass over the list, however it is chunked.
+ * A record shorter than the quantum leaves the rest of it zeroed, as
+ * it was allocated. The range written is returned in changed. Called
+ * with the device semaphore held for reading.
+ */
+
+long scull_import(struct scull_file *sf, const char __user *buf, size_t len, u64 *pos,
+                  struct scull_range *changed) {
+    struct scull_dev *dev = sf->dev;
+    struct scull_stream_rec rec;
+    struct scull_qset *dptr = NULL;
+    struct mutex *stripe = NULL;
+    int quantum = dev->quantum, qset = dev->qset;
+    long size = atomic_long_read(&dev->size);
+    long retval = 0;
+    size_t done = 0;
+    unsigned long left;
+    loff_t start, lo = LLONG_MAX, hi = 0;
+    int s_pos;
+
+    while (done + sizeof(rec) <= len) {
+        if (copy_from_user(&rec, buf + done, sizeof(rec))) {
+            retval = -EFAULT;
+            break;
+        }
+        if (rec.len > quantum || rec.quantum >= DIV_ROUND_UP(size, quantum) ||
+            (long) rec.quantum * quantum + rec.len > size) {
+            retval = -EINVAL;
+            break;
+        }
+        if (done + sizeof(rec) + rec.len > len)
+            break; // the caller hands it over again, complete
+
+        if (!dptr || dptr->item != rec.quantum / qset) {
+            if (stripe)
+                mutex_unlock(stripe);
+            stripe = NULL;
+            dptr = scull_follow_cached(sf, rec.quantum / qset, 1);
+            if (!dptr) {
+                retval = -ENOMEM;
+                break;
+            }
+            stripe = scull_stripe(dev, dptr->item);
+            mutex_lock(stripe);
+        }
+        s_pos = rec.quantum % qset;
+        if (!dptr->data && scull_alloc_data(dev, dptr)) {
+            retval = -ENOMEM;
+            break;
+        }
+        if (!dptr->data[s_pos] && (retval = scull_alloc_quantum(dev, dptr, s_pos)))
+            break;
+        this_cpu_inc(dev->stats->writes);
+        scull_undiscard(dev, dptr, s_pos);
+        left = copy_from_user(dptr->data[s_pos], buf + done + sizeof(rec), rec.len);
+        if (dptr->sum)
+            scull_sum_write(dev, dptr, s_pos, 0, rec.len);
+        if (left) {
+            retval = -EFAULT;
+            break;
+        }
+        start = (loff_t) rec.quantum * quantum;
+        lo = min(lo, start);
+        hi = max(hi, start + rec.len);
+        done += sizeof(rec) + rec.len;
+        *pos = rec.quantum + 2;
+    }
+    if (stripe)
+        mutex_unlock(stripe);
+    *changed = (struct scull_range) {lo, hi > lo ? hi - lo : 0};
+    if (!retval && !done && len)
+        retval = -ENOSPC; // not even one record fits
+    return done ? done : retval;
+}
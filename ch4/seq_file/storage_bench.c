@@ -0,0 +1,262 @@
+/*
+ * storage_bench: time the storage engine hot paths in user space,
+ * with no syscall, copy_*_user fault handling or module in the way.
+ * Meant to be run under perf or with sanitizers; see "make user".
+ */
+
+#include "scull_user.h"
+
+#include <getopt.h>
+#include <time.h>
+
+#include "scull.h"
+
+struct opts {
+    int quantum, qset;
+    size_t io_size;
+    long long span;
+    int rounds;
+    int threads;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static int direct; // transfers go through the direct path
+
+/*
+ * Move a whole buffer, one quantum step at a time, like a read(2) or
+ * write(2) loop in user space would.
+ */
+static int xfer(struct scull_file *sf, char *buf, size_t count, loff_t pos, int write) {
+    ssize_t ret;
+
+    while (count) {
+        if (direct)
+            ret = write ? scull_direct_write(sf, buf, count, &pos) : scull_direct_read(sf, buf, count, &pos);
+        else if (write)
+            ret = scull_do_write(sf, buf, count, &pos);
+        else
+            ret = scull_do_read(sf, buf, count, &pos);
+        if (ret <= 0)
+            return ret ? ret : -EIO;
+        buf += ret;
+        count -= ret;
+    }
+    return 0;
+}
+
+static void report(const char *name, long ops, size_t io_size, uint64_t ns) {
+    printf("%-12s %10ld ops %10.1f ns/op %10.1f MB/s\n", name, ops,
+           (double) ns / ops, (double) ops * io_size / ns * 1e3);
+}
+
+/*
+ * One pass over the span with the given access pattern; a fresh file
+ * (cold cursor) is used for every op when cold is set.
+ */
+static void run(const char *name, struct scull_dev *dev, const struct opts *o,
+                char *buf, int write, int random, int cold) {
+    long slots = o->span / o->io_size, ops = slots * o->rounds, i;
+    struct scull_file sf;
+    uint64_t seed = 88172645463325252ull, t0;
+    loff_t pos;
+
+    scull_user_file_init(&sf, dev);
+    t0 = now_ns();
+    for (i = 0; i < ops; i++) {
+        pos = (random ? (long) (xorshift(&seed) % slots) : i % slots) * (loff_t) o->io_size;
+        if (cold)
+            scull_user_file_init(&sf, dev);
+        if (xfer(&sf, buf, o->io_size, pos, write)) {
+            fprintf(stderr, "%s: transfer failed at %lld\n", name, (long long) pos);
+            exit(1);
+        }
+    }
+    report(name, ops, o->io_size, now_ns() - t0);
+}
+
+/*
+ * Move the whole device into a fresh one through the export stream,
+ * in chunks of 1 MB, the way a migration tool would.
+ */
+static void run_migrate(struct scull_dev *dev) {
+    size_t chunk = 1 << 20, used = 0, cap = chunk, off;
+    struct scull_file sf, to;
+    struct scull_range changed;
+    struct scull_dev copy;
+    char *stream = malloc(cap);
+    u64 pos = 0;
+    uint64_t t0;
+    long n;
+
+    scull_user_file_init(&sf, dev);
+    t0 = now_ns();
+    while (stream && (n = scull_export(&sf, stream + used, chunk, &pos)) > 0) {
+        used += n;
+        if (cap - used < chunk)
+            stream = realloc(stream, cap *= 2);
+    }
+    if (!stream || n < 0) {
+        fprintf(stderr, "export failed\n");
+        exit(1);
+    }
+    report("export", 1, used, now_ns() - t0);
+
+    // this sets the module geometry too, so keep it; import picks the copy's
+    scull_user_dev_init(&copy, scull_quantum, scull_qset);
+    scull_user_file_init(&to, &copy);
+    t0 = now_ns();
+    if (scull_import_start(&copy, (struct scull_stream_hdr *) stream))
+        exit(1);
+    for (off = sizeof(struct scull_stream_hdr), pos = 1; off < used; off += n) {
+        n = scull_import(&to, stream + off, min(chunk, used - off), &pos, &changed);
+        if (n <= 0) {
+            fprintf(stderr, "import failed\n");
+            exit(1);
+        }
+    }
+    report("import", 1, used, now_ns() - t0);
+    scull_user_dev_exit(&copy);
+    free(stream);
+}
+
+/*
+ * Parallel run: every thread streams over its own slice of the span
+ * through its own file, taking the device semaphore for reading around
+ * each transfer the way scull_read() and scull_write() do.
+ */
+struct worker {
+    pthread_t tid;
+    struct scull_dev *dev;
+    const struct opts *o;
+    loff_t start;
+    long slots;
+    int write;
+};
+
+static void *worker(void *arg) {
+    struct worker *w = arg;
+    struct scull_file sf;
+    char *buf = malloc(w->o->io_size);
+    long i;
+    int ret;
+
+    if (!buf)
+        exit(1);
+    memset(buf, 0x5a, w->o->io_size);
+    scull_user_file_init(&sf, w->dev);
+    for (i = 0; i < w->slots * w->o->rounds; i++) {
+        down_read_interruptible(&w->dev->sem);
+        ret = xfer(&sf, buf, w->o->io_size, w->start + i % w->slots * (loff_t) w->o->io_size, w->write);
+        up_read(&w->dev->sem);
+        if (ret) {
+            fprintf(stderr, "worker: transfer failed\n");
+            exit(1);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static void run_par(const char *name, struct scull_dev *dev, const struct opts *o, int write) {
+    struct worker *w = calloc(o->threads, sizeof(*w));
+    long slots = o->span / o->io_size / o->threads;
+    uint64_t t0;
+    int i;
+
+    if (!w)
+        exit(1);
+    t0 = now_ns();
+    for (i = 0; i < o->threads; i++) {
+        w[i] = (struct worker) {.dev = dev, .o = o, .slots = slots, .write = write,
+                                .start = i * slots * (loff_t) o->io_size};
+        pthread_create(&w[i].tid, NULL, worker, &w[i]);
+    }
+    for (i = 0; i < o->threads; i++)
+        pthread_join(w[i].tid, NULL);
+    report(name, slots * o->rounds * o->threads, o->io_size, now_ns() - t0);
+    free(w);
+}
+
+int main(int argc, char **argv) {
+    struct opts o = {SCULL_QUANTUM, SCULL_QSET, 4000, 64 << 20, 4, 1};
+    struct scull_stats stats;
+    struct scull_dev dev;
+    uint64_t t0;
+    char *buf;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:cq:Q:s:S:r:t:")) != -1) {
+        switch (opt) {
+        case 'a': scull_aligned = atoi(optarg); break;
+        case 'c': scull_crc = 1; break;
+        case 'q': o.quantum = atoi(optarg); break;
+        case 'Q': o.qset = atoi(optarg); break;
+        case 's': o.io_size = strtoul(optarg, NULL, 0); break;
+        case 'S': o.span = strtoll(optarg, NULL, 0); break;
+        case 'r': o.rounds = atoi(optarg); break;
+        case 't': o.threads = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-a layout] [-c] [-q quantum] [-Q qset] [-s io_size] [-S span] [-r rounds] [-t threads]\n"
+                            "  layout: 0 packed, 1 cache-line aligned, 2 page aligned quanta\n"
+                            "  -c: checksum quanta\n", argv[0]);
+            return 2;
+        }
+    }
+    if (o.quantum <= 0 || o.qset <= 0 || !o.io_size || o.rounds <= 0 || o.threads <= 0 ||
+        o.span < (long long) o.io_size * o.threads)
+        return 2;
+
+    buf = malloc(o.io_size);
+    if (!buf)
+        return 1;
+    memset(buf, 0x5a, o.io_size);
+    scull_user_dev_init(&dev, o.quantum, o.qset);
+
+    printf("quantum %d (layout %d: %d), %s, qset %d, io %zu, span %lld, %d rounds, %d threads\n",
+           o.quantum, scull_aligned, dev.quantum, dev.crc ? "crc32c" : "no checksums", o.qset, o.io_size, o.span, o.rounds, o.threads);
+    run("seq write", &dev, &o, buf, 1, 0, 0);
+    run("seq read", &dev, &o, buf, 0, 0, 0);
+    run("rand write", &dev, &o, buf, 1, 1, 0);
+    run("rand read", &dev, &o, buf, 0, 1, 0);
+    run("cold read", &dev, &o, buf, 0, 1, 1);
+    direct = 1;
+    run("direct write", &dev, &o, buf, 1, 0, 0);
+    run("direct read", &dev, &o, buf, 0, 0, 0);
+    direct = 0;
+    run_migrate(&dev);
+    if (o.threads > 1) {
+        scull_trim(&dev); // so that the writers build the list together
+        run_par("par write", &dev, &o, 1);
+        run_par("par read", &dev, &o, 0);
+    }
+
+    // drops the upper half walking back from the tail
+    t0 = now_ns();
+    scull_truncate(&dev, o.span / 2);
+    report("truncate", 1, o.span - o.span / 2, now_ns() - t0);
+
+    t0 = now_ns();
+    scull_trim(&dev);
+    report("trim", 1, o.span / 2, now_ns() - t0);
+    scull_get_stats(&dev, &stats);
+    printf("allocs %llu, frees %llu, checked %llu, crc errors %llu\n",
+           (unsigned long long) stats.allocs, (unsigned long long) stats.frees,
+           (unsigned long long) stats.checked, (unsigned long long) stats.crc_errors);
+    scull_user_dev_exit(&dev);
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,426 @@
+/*
+ * storage_fuzz: differential fuzz target for the storage engine.
+ *
+ * The input is a little program of reads and writes (through the
+ * quantum loop or the direct path), trims, discards, reclaims, hole
+ * punches, truncates, checksum corruptions, migrations and allocation
+ * failures run against both a scull_dev (with or without a memory
+ * limit) and a flat byte array; every read must agree with the model.
+ * Built as a libFuzzer target with clang ("make storage_fuzz_libfuzzer"),
+ * or with any compiler as a standalone driver that replays files or
+ * random inputs ("make user").
+ */
+
+#include "scull_user.h"
+
+#include "scull.h"
+
+#define FUZZ_SPAN (256 * 1024) // offsets are kept below this
+
+struct model {
+    unsigned char data[FUZZ_SPAN];
+    unsigned char written[FUZZ_SPAN]; // byte was ever written since the last trim
+    unsigned char unsure[FUZZ_SPAN];  // discarded: old data or zeroes, if not a hole
+    long size;
+};
+
+static struct model model;
+
+static unsigned int take(const uint8_t **p, size_t *left, int bytes) {
+    unsigned int v = 0;
+
+    while (bytes-- && *left) {
+        v = v << 8 | **p;
+        (*p)++;
+        (*left)--;
+    }
+    return v;
+}
+
+/*
+ * A hole is a quantum that was never allocated. Reads stop short there,
+ * and that is only legal if no byte of the quantum was written.
+ */
+static void check_hole(struct scull_dev *dev, long pos) {
+    long start = pos - pos % dev->quantum, i;
+
+    for (i = start; i < start + dev->quantum && i < FUZZ_SPAN; i++)
+        if (model.written[i]) {
+            fprintf(stderr, "read stopped at %ld, but %ld was written\n", pos, i);
+            abort();
+        }
+}
+
+static void do_read(struct scull_file *sf, long pos, size_t len, int direct) {
+    static char buf[FUZZ_SPAN];
+    struct scull_dev *dev = sf->dev;
+    loff_t p = pos;
+    size_t done = 0;
+    ssize_t ret;
+    long i;
+
+    while (done < len) {
+        if (direct)
+            ret = scull_direct_read(sf, buf + done, len - done, &p);
+        else
+            ret = scull_do_read(sf, buf + done, len - done, &p);
+        if (ret < 0)
+            abort(); // failures are only injected around writes
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+    if (p != pos + (long) done)
+        abort();
+    // bytes never written read as zeroes, never as old memory
+    for (i = 0; i < (long) done; i++)
+        if ((unsigned char) buf[i] != model.data[pos + i] && !model.unsure[pos + i]) {
+            fprintf(stderr, "mismatch at %ld\n", pos + i);
+            abort();
+        }
+    if (done < len && pos + (long) done < model.size)
+        check_hole(dev, pos + done);
+    if (done && pos + (long) done > model.size)
+        abort();
+    if (atomic_long_read(&dev->size) != model.size)
+        abort();
+}
+
+static void do_write(struct scull_file *sf, long pos, size_t len, unsigned char seed, int direct) {
+    static char buf[FUZZ_SPAN];
+    loff_t p = pos;
+    size_t done = 0, i;
+    ssize_t ret;
+
+    for (i = 0; i < len; i++)
+        buf[i] = seed + i;
+    while (done < len) {
+        if (direct)
+            ret = scull_direct_write(sf, buf + done, len - done, &p);
+        else
+            ret = scull_do_write(sf, buf + done, len - done, &p);
+        if (ret < 0) {
+            if (ret != -ENOMEM && !(ret == -ENOSPC && sf->dev->limit))
+                abort();
+            break; // injected failure or a full device: keep what went in
+        }
+        done += ret;
+    }
+    memcpy(model.data + pos, buf, done);
+    memset(model.written + pos, 1, done);
+    memset(model.unsure + pos, 0, done);
+    if (done && pos + (long) done > model.size)
+        model.size = pos + done;
+}
+
+/*
+ * Quanta marked discardable may vanish at any time, so the model forgets
+ * they were ever written, and what they hold until the next write. Only
+ * whole quanta below the size are marked.
+ */
+static void do_discard(struct scull_dev *dev, long pos, size_t len) {
+    long first = DIV_ROUND_UP(pos, dev->quantum) * dev->quantum;
+    long end = (pos + (long) len) / dev->quantum * dev->quantum;
+    int armed = scull_user_fail_after != 0;
+
+    if (scull_mark_discardable(dev, pos, len) && !armed)
+        abort(); // only an injected allocation failure may stop it
+    end = min(end, DIV_ROUND_UP(model.size, dev->quantum) * dev->quantum);
+    end = min(end, (long) FUZZ_SPAN);
+    if (end > first) {
+        memset(model.written + first, 0, end - first);
+        memset(model.unsure + first, 1, end - first);
+    }
+}
+
+/*
+ * A punched range reads as zeroes where quanta remain and as holes where
+ * whole quanta went; the quantum holding the end of data goes whole.
+ */
+static void do_punch(struct scull_dev *dev, long pos, size_t len) {
+    long end = min(pos + (long) len, model.size);
+    long first = DIV_ROUND_UP(pos, dev->quantum) * dev->quantum;
+    long last = end / dev->quantum * dev->quantum;
+    long span = (long) dev->quantum * dev->qset;
+    struct scull_qset *qs;
+
+    if (scull_punch(dev, pos, len))
+        abort();
+    if (pos >= end)
+        return;
+    if (end == model.size)
+        last = min(DIV_ROUND_UP(end, dev->quantum) * dev->quantum, (long) FUZZ_SPAN);
+    memset(model.data + pos, 0, end - pos);
+    memset(model.unsure + pos, 0, end - pos);
+    if (last > first)
+        memset(model.written + first, 0, last - first);
+    // list items wholly inside the hole must be gone
+    list_for_each_entry(qs, &dev->qsets, list)
+        if (qs->item * span >= first && (qs->item + 1) * span <= last)
+            abort();
+}
+
+/*
+ * Shrinking forgets everything past the new end; growing adds a hole.
+ */
+static void do_truncate(struct scull_dev *dev, long size) {
+    int shrink = size < model.size;
+
+    if (scull_truncate(dev, size))
+        abort();
+    if (shrink) {
+        memset(model.data + size, 0, model.size - size);
+        memset(model.written + size, 0, model.size - size);
+        memset(model.unsure + size, 0, model.size - size);
+    }
+    model.size = size;
+    if (atomic_long_read(&dev->size) != size)
+        abort();
+    // nothing is left past the end
+    if (shrink && !list_empty(&dev->qsets) &&
+        list_last_entry(&dev->qsets, struct scull_qset, list)->item * dev->qset * dev->quantum >= size)
+        abort();
+}
+
+/*
+ * Flip a bit behind the checksum's back: the next read of the block
+ * and a scrub must both notice, and a scrub must be happy once it is
+ * flipped back.
+ */
+static void do_corrupt(struct scull_dev *dev, struct scull_file *sf, long pos) {
+    long q = pos / dev->quantum;
+    struct scull_qset *dptr = scull_follow(dev, q / dev->qset, 0);
+    int s_pos = q % dev->qset, b = pos % dev->quantum / SCULL_CRC_BLOCK;
+    struct scull_sum *sum;
+    loff_t p = q * dev->quantum;
+    static char buf[SCULL_CRC_BLOCK * 8];
+    char *byte;
+
+    if (!dev->crc || !dptr || !dptr->data || !dptr->data[s_pos])
+        return;
+    // damage to a block not summed yet goes unnoticed, sum them all first
+    if (scull_scrub(dev))
+        abort();
+    sum = &dptr->sum[s_pos * DIV_ROUND_UP(dev->quantum, SCULL_CRC_BLOCK) + b];
+    if (!sum->len)
+        return;
+    byte = (char *) dptr->data[s_pos] + b * SCULL_CRC_BLOCK + pos % sum->len;
+    *byte ^= 0x40;
+    sum->verified = false;
+    // a read from the start of the quantum up to the block must fail
+    if (p + b * SCULL_CRC_BLOCK < model.size && scull_do_read(sf, buf, b * SCULL_CRC_BLOCK + 1, &p) != -EIO)
+        abort();
+    if (scull_scrub(dev) != 1)
+        abort();
+    *byte ^= 0x40;
+    if (scull_scrub(dev))
+        abort();
+}
+
+/*
+ * Export the device in chunks of one size and import the stream into a
+ * fresh device in chunks of another, the way a migration tool would:
+ * the copy must hold the same quanta, holes included, and the same data
+ * up to the size.
+ */
+static void do_migrate(struct scull_file *sf, size_t len) {
+    struct scull_dev *dev = sf->dev;
+    static char stream[sizeof(struct scull_stream_hdr) + FUZZ_SPAN * (sizeof(struct scull_stream_rec) + 1)];
+    size_t min_chunk = sizeof(struct scull_stream_hdr) + sizeof(struct scull_stream_rec) + dev->quantum;
+    size_t used = 0, off, chunk;
+    struct scull_range changed;
+    struct scull_qset *a, *b;
+    struct scull_dev copy;
+    struct scull_file to;
+    struct list_head *lp;
+    long n, q, size, last, nr = 0;
+    u64 pos = 0;
+    int s_pos;
+
+    chunk = min_chunk + len;
+    while ((n = scull_export(sf, stream + used, min(chunk, sizeof(stream) - used), &pos)) > 0)
+        used += n;
+    if (n < 0 || used < sizeof(struct scull_stream_hdr))
+        abort();
+
+    // this sets the module geometry too, so keep it; import picks the copy's
+    scull_user_dev_init(&copy, scull_quantum, scull_qset);
+    scull_user_file_init(&to, &copy);
+    if (scull_import_start(&copy, (struct scull_stream_hdr *) stream))
+        abort();
+    chunk = min_chunk + len / 3;
+    for (off = sizeof(struct scull_stream_hdr), pos = 1; off < used; off += n) {
+        n = scull_import(&to, stream + off, min(chunk, used - off), &pos, &changed);
+        if (n <= 0)
+            abort();
+    }
+
+    size = atomic_long_read(&dev->size);
+    if (atomic_long_read(&copy.size) != size || copy.quantum != dev->quantum || copy.qset != dev->qset)
+        abort();
+    // walk both lists side by side: every quantum below the size is in both or neither
+    last = DIV_ROUND_UP(size, dev->quantum);
+    lp = copy.qsets.next;
+    list_for_each_entry(a, &dev->qsets, list) {
+        for (s_pos = 0; a->data && s_pos < dev->qset; s_pos++) {
+            q = a->item * dev->qset + s_pos;
+            if (q >= last || !a->data[s_pos])
+                continue;
+            while (lp != &copy.qsets && list_entry(lp, struct scull_qset, list)->item < a->item)
+                lp = lp->next;
+            b = lp != &copy.qsets ? list_entry(lp, struct scull_qset, list) : NULL;
+            if (!b || b->item != a->item || !b->data || !b->data[s_pos] ||
+                memcmp(a->data[s_pos], b->data[s_pos], min((long) dev->quantum, size - q * dev->quantum)))
+                abort();
+            nr++;
+        }
+    }
+    list_for_each_entry(b, &copy.qsets, list)
+        for (s_pos = 0; b->data && s_pos < dev->qset; s_pos++)
+            if (b->data[s_pos] && --nr < 0)
+                abort(); // a hole got filled
+    if (scull_scrub(&copy))
+        abort();
+    scull_user_dev_exit(&copy);
+}
+
+/*
+ * The memory a device is charged for is what its quanta take, and stays
+ * within its limit.
+ */
+static void check_mem(struct scull_dev *dev) {
+    struct scull_qset *qs;
+    long mem = 0;
+    int i;
+
+    list_for_each_entry(qs, &dev->qsets, list)
+        for (i = 0; qs->data && i < dev->qset; i++)
+            if (qs->data[i])
+                mem += dev->quantum;
+    if (atomic_long_read(&dev->mem) != mem || (dev->limit && mem > dev->limit))
+        abort();
+}
+
+static void run(const uint8_t *p, size_t left) {
+    struct scull_dev dev;
+    struct scull_file sf[2];
+    int quantum, qset, limit;
+    unsigned int op;
+    long pos;
+    size_t len;
+
+    // small geometries exercise qset boundaries and the list walk
+    quantum = 1 + take(&p, &left, 1) % 64;
+    qset = 1 + take(&p, &left, 1) % 16;
+    scull_aligned = take(&p, &left, 1) % 3;
+    scull_crc = take(&p, &left, 1) % 2;
+    limit = take(&p, &left, 1);
+    scull_user_dev_init(&dev, quantum, qset);
+    dev.limit = limit % 4 ? 0 : (limit / 4 + 1) * 4L * dev.quantum;
+    scull_user_file_init(&sf[0], &dev);
+    scull_user_file_init(&sf[1], &dev);
+    memset(&model, 0, sizeof(model));
+
+    while (left) {
+        op = take(&p, &left, 1);
+        pos = take(&p, &left, 3) % FUZZ_SPAN;
+        len = take(&p, &left, 2) % 4096;
+        if (pos + (long) len > FUZZ_SPAN)
+            len = FUZZ_SPAN - pos;
+        switch (op % 14) {
+        case 0: case 1: case 2:
+            do_write(&sf[op / 8 % 2], pos, len, op, op / 16 % 2);
+            break;
+        case 3: case 4: case 5:
+            scull_user_fail_after = 0;
+            do_read(&sf[op / 8 % 2], pos, len, op / 16 % 2);
+            break;
+        case 6:
+            scull_trim(&dev);
+            memset(&model, 0, sizeof(model));
+            break;
+        case 7: // fail one of the next few allocations
+            scull_user_fail_after = 1 + len % 4;
+            break;
+        case 8:
+            do_discard(&dev, pos, len);
+            break;
+        case 9:
+            scull_reclaim(&dev, 1 + len % 8);
+            if (atomic_long_read(&dev.nr_discardable) > FUZZ_SPAN)
+                abort();
+            break;
+        case 10:
+            do_punch(&dev, pos, len);
+            break;
+        case 11:
+            do_truncate(&dev, pos);
+            break;
+        case 12:
+            do_corrupt(&dev, &sf[0], pos);
+            break;
+        case 13:
+            scull_user_fail_after = 0;
+            do_migrate(&sf[1], len);
+            break;
+        }
+    }
+    scull_user_fail_after = 0;
+    check_mem(&dev);
+    if (scull_scrub(&dev))
+        abort(); // every checksum must still hold
+    scull_user_dev_exit(&dev);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    run(data, size);
+    return 0;
+}
+
+#ifndef SCULL_LIBFUZZER
+
+/*
+ * Standalone driver: replay the files given on the command line, or
+ * run random inputs when there are none.
+ */
+int main(int argc, char **argv) {
+    static uint8_t buf[1 << 16];
+    uint64_t s = 0x2545f4914f6cdd1dull;
+    size_t n, i;
+    long iter, iters = 20000;
+    FILE *f;
+    int k;
+
+    if (argc > 1) {
+        for (k = 1; k < argc; k++) {
+            f = fopen(argv[k], "rb");
+            if (!f) {
+                perror(argv[k]);
+                return 1;
+            }
+            n = fread(buf, 1, sizeof(buf), f);
+            fclose(f);
+            run(buf, n);
+        }
+        return 0;
+    }
+    if (getenv("FUZZ_ITERS"))
+        iters = atol(getenv("FUZZ_ITERS"));
+    for (iter = 0; iter < iters; iter++) {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        n = 2 + s % 512;
+        for (i = 0; i < n; i++) {
+            s ^= s << 13;
+            s ^= s >> 7;
+            s ^= s << 17;
+            buf[i] = s;
+        }
+        run(buf, n);
+    }
+    printf("%ld inputs ok\n", iters);
+    return 0;
+}
+
+#endif // SCULL_LIBFUZZER
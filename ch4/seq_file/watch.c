@@ -0,0 +1,187 @@
+#include <linux/eventfd.h>
+#include <linux/fs.h>
+#include <linux/kernel.h> // min, u64_to_user_ptr
+#include <linux/list.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/uaccess.h> // copy_to_user
+#include <linux/version.h>
+#include <linux/wait.h>
+
+#include "scull.h"
+
+/*
+ * Change notification for scull devices.
+ *
+ * A mirror of a device registers as a watcher (by polling it, asking for
+ * changes or handing over an eventfd) and does one full copy. From then
+ * on every write, hole punch, truncate and trim appends a record of the
+ * byte range it touched to a small ring in the device, merging it with
+ * the newest record when the two ranges touch, and wakes the pollers
+ * and eventfds. SCULL_IOCCHANGES hands out the records a file has not
+ * seen yet; if the ring wrapped past them, the file is told to copy
+ * everything again.
+ *
+ * As long as nobody watches a device, its I/O paths pay one atomic
+ * read for all this.
+ */
+
+void scull_watch_init(struct scull_watch *watch) {
+    spin_lock_init(&watch->lock);
+    atomic_set(&watch->watchers, 0);
+    INIT_LIST_HEAD(&watch->files);
+    init_waitqueue_head(&watch->wait);
+}
+
+static void scull_watch_start(struct scull_file *sf) {
+    struct scull_watch *watch = &sf->dev->watch;
+
+    spin_lock(&watch->lock);
+    if (!sf->watching) {
+        sf->watching = true;
+        sf->seen = watch->seq; // the full copy that comes first covers the past
+        atomic_inc(&watch->watchers);
+    }
+    spin_unlock(&watch->lock);
+}
+
+static void scull_eventfd_signal(struct eventfd_ctx *efd) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+    eventfd_signal(efd);
+#else
+    eventfd_signal(efd, 1);
+#endif
+}
+
+void scull_notify(struct scull_dev *dev, loff_t start, loff_t len) {
+    struct scull_watch *watch = &dev->watch;
+    struct scull_change *rec;
+    struct scull_file *sf;
+    u64 end = start + len;
+
+    if (!atomic_read(&watch->watchers) || len <= 0)
+        return;
+
+    spin_lock(&watch->lock);
+    rec = &watch->rec[(watch->head - 1) % SCULL_WATCH_RECORDS];
+    if (watch->head && start <= rec->offset + rec->len && end >= rec->offset) {
+        // touches the newest record: grow it and make it new again
+        end = max(end, rec->offset + rec->len);
+        rec->offset = min((u64) start, rec->offset);
+        rec->len = end - rec->offset;
+    } else {
+        rec = &watch->rec[watch->head % SCULL_WATCH_RECORDS];
+        if (watch->head >= SCULL_WATCH_RECORDS)
+            watch->lost = rec->seq;
+        watch->head++;
+        rec->offset = start;
+        rec->len = len;
+    }
+    rec->seq = ++watch->seq;
+    list_for_each_entry(sf, &watch->files, watch)
+        scull_eventfd_signal(sf->efd);
+    spin_unlock(&watch->lock);
+
+    wake_up_interruptible(&watch->wait);
+}
+
+/*
+ * Install (fd >= 0) or drop (fd == -1) the eventfd of a file
+ */
+
+int scull_watch_eventfd(struct scull_file *sf, int fd) {
+    struct scull_watch *watch = &sf->dev->watch;
+    struct eventfd_ctx *efd = NULL, *old;
+
+    if (fd != -1) {
+        efd = eventfd_ctx_fdget(fd);
+        if (IS_ERR(efd))
+            return PTR_ERR(efd);
+        scull_watch_start(sf);
+    }
+
+    spin_lock(&watch->lock);
+    old = sf->efd;
+    if (old)
+        list_del(&sf->watch);
+    sf->efd = efd;
+    if (efd)
+        list_add_tail(&sf->watch, &watch->files);
+    spin_unlock(&watch->lock);
+
+    if (old)
+        eventfd_ctx_put(old);
+    return 0;
+}
+
+/*
+ * Copy out the records this file has not seen, oldest first. They are
+ * staged in a small buffer, as the ring may not be touched by a copy
+ * to user space under its spinlock.
+ */
+
+long scull_watch_changes(struct scull_file *sf, struct scull_changes __user *uarg) {
+    struct scull_watch *watch = &sf->dev->watch;
+    struct scull_change *buf;
+    struct scull_changes args;
+    unsigned long i, oldest;
+    long n = 0;
+
+    if (copy_from_user(&args, uarg, sizeof(args)))
+        return -EFAULT;
+    scull_watch_start(sf);
+    buf = kmalloc_array(SCULL_WATCH_RECORDS, sizeof(*buf), GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+
+    args.flags = 0;
+    spin_lock(&watch->lock);
+    if (sf->seen < watch->lost) {
+        args.flags |= SCULL_CHANGES_LOST;
+        sf->seen = watch->seq;
+    }
+    // only the newest record is ever merged into, so the ring is in seq order
+    oldest = watch->head > SCULL_WATCH_RECORDS ? watch->head - SCULL_WATCH_RECORDS : 0;
+    for (i = oldest; i < watch->head && n < args.nr; i++)
+        if (watch->rec[i % SCULL_WATCH_RECORDS].seq > sf->seen)
+            buf[n++] = watch->rec[i % SCULL_WATCH_RECORDS];
+    if (i == watch->head)
+        sf->seen = watch->seq;
+    else if (n) // out of room: the rest next time
+        sf->seen = buf[n - 1].seq;
+    spin_unlock(&watch->lock);
+    args.size = atomic_long_read(&sf->dev->size);
+
+    if (copy_to_user(u64_to_user_ptr(args.buf), buf, n * sizeof(*buf)) ||
+        copy_to_user(uarg, &args, sizeof(args)))
+        n = -EFAULT;
+    kfree(buf);
+    return n;
+}
+
+/*
+ * Readable means there are changes this file has not been told about;
+ * a scull device can always be written.
+ */
+
+__poll_t scull_watch_poll(struct file *filp, poll_table *wait) {
+    struct scull_file *sf = filp->private_data;
+    struct scull_watch *watch = &sf->dev->watch;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    scull_watch_start(sf);
+    poll_wait(filp, &watch->wait, wait);
+    if (READ_ONCE(watch->seq) != READ_ONCE(sf->seen))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
+}
+
+void scull_watch_release(struct scull_file *sf) {
+    struct scull_watch *watch = &sf->dev->watch;
+
+    scull_watch_eventfd(sf, -1);
+    if (sf->watching)
+        atomic_dec(&watch->watchers);
+}